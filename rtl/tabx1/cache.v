@@ -44,27 +44,31 @@ module cache (
 	wrreq,
 	q,
 	rdempty,
+	rdusedw,
 	wrfull,
 	wrusedw);
 
-	input	[27:0]  data;
+	input	[17:0]  data;
 	input	  rdclk;
 	input	  rdreq;
 	input	  wrclk;
 	input	  wrreq;
-	output	[27:0]  q;
+	output	[17:0]  q;
 	output	  rdempty;
+	output	[11:0]  rdusedw;
 	output	  wrfull;
 	output	[11:0]  wrusedw;
 
 	wire  sub_wire0;
-	wire [27:0] sub_wire1;
+	wire [17:0] sub_wire1;
 	wire  sub_wire2;
 	wire [11:0] sub_wire3;
+	wire [11:0] sub_wire4;
 	wire  wrfull = sub_wire0;
-	wire [27:0] q = sub_wire1[27:0];
+	wire [17:0] q = sub_wire1[17:0];
 	wire  rdempty = sub_wire2;
 	wire [11:0] wrusedw = sub_wire3[11:0];
+	wire [11:0] rdusedw = sub_wire4[11:0];
 
 	dcfifo	dcfifo_component (
 				.rdclk (rdclk),
@@ -78,14 +82,14 @@ module cache (
 				.wrusedw (sub_wire3),
 				.aclr (),
 				.rdfull (),
-				.rdusedw (),
+				.rdusedw (sub_wire4),
 				.wrempty ());
 	defparam
 		dcfifo_component.intended_device_family = "Cyclone III",
 		dcfifo_component.lpm_numwords = 4096,
 		dcfifo_component.lpm_showahead = "OFF",
 		dcfifo_component.lpm_type = "dcfifo",
-		dcfifo_component.lpm_width = 28,
+		dcfifo_component.lpm_width = 18,
 		dcfifo_component.lpm_widthu = 12,
 		dcfifo_component.overflow_checking = "ON",
 		dcfifo_component.rdsync_delaypipe = 5,
@@ -118,14 +122,14 @@ endmodule
 // Retrieval info: PRIVATE: SYNTH_WRAPPER_GEN_POSTFIX STRING "0"
 // Retrieval info: PRIVATE: UNDERFLOW_CHECKING NUMERIC "0"
 // Retrieval info: PRIVATE: UsedW NUMERIC "0"
-// Retrieval info: PRIVATE: Width NUMERIC "28"
+// Retrieval info: PRIVATE: Width NUMERIC "18"
 // Retrieval info: PRIVATE: dc_aclr NUMERIC "0"
 // Retrieval info: PRIVATE: diff_widths NUMERIC "0"
 // Retrieval info: PRIVATE: msb_usedw NUMERIC "0"
-// Retrieval info: PRIVATE: output_width NUMERIC "28"
+// Retrieval info: PRIVATE: output_width NUMERIC "18"
 // Retrieval info: PRIVATE: rsEmpty NUMERIC "1"
 // Retrieval info: PRIVATE: rsFull NUMERIC "0"
-// Retrieval info: PRIVATE: rsUsedW NUMERIC "0"
+// Retrieval info: PRIVATE: rsUsedW NUMERIC "1"
 // Retrieval info: PRIVATE: sc_aclr NUMERIC "0"
 // Retrieval info: PRIVATE: sc_sclr NUMERIC "0"
 // Retrieval info: PRIVATE: wsEmpty NUMERIC "0"
@@ -136,29 +140,31 @@ endmodule
 // Retrieval info: CONSTANT: LPM_NUMWORDS NUMERIC "4096"
 // Retrieval info: CONSTANT: LPM_SHOWAHEAD STRING "OFF"
 // Retrieval info: CONSTANT: LPM_TYPE STRING "dcfifo"
-// Retrieval info: CONSTANT: LPM_WIDTH NUMERIC "28"
+// Retrieval info: CONSTANT: LPM_WIDTH NUMERIC "18"
 // Retrieval info: CONSTANT: LPM_WIDTHU NUMERIC "12"
 // Retrieval info: CONSTANT: OVERFLOW_CHECKING STRING "ON"
 // Retrieval info: CONSTANT: RDSYNC_DELAYPIPE NUMERIC "5"
 // Retrieval info: CONSTANT: UNDERFLOW_CHECKING STRING "ON"
 // Retrieval info: CONSTANT: USE_EAB STRING "ON"
 // Retrieval info: CONSTANT: WRSYNC_DELAYPIPE NUMERIC "5"
-// Retrieval info: USED_PORT: data 0 0 28 0 INPUT NODEFVAL "data[27..0]"
-// Retrieval info: USED_PORT: q 0 0 28 0 OUTPUT NODEFVAL "q[27..0]"
+// Retrieval info: USED_PORT: data 0 0 18 0 INPUT NODEFVAL "data[17..0]"
+// Retrieval info: USED_PORT: q 0 0 18 0 OUTPUT NODEFVAL "q[17..0]"
 // Retrieval info: USED_PORT: rdclk 0 0 0 0 INPUT NODEFVAL "rdclk"
 // Retrieval info: USED_PORT: rdempty 0 0 0 0 OUTPUT NODEFVAL "rdempty"
 // Retrieval info: USED_PORT: rdreq 0 0 0 0 INPUT NODEFVAL "rdreq"
+// Retrieval info: USED_PORT: rdusedw 0 0 12 0 OUTPUT NODEFVAL "rdusedw[11..0]"
 // Retrieval info: USED_PORT: wrclk 0 0 0 0 INPUT NODEFVAL "wrclk"
 // Retrieval info: USED_PORT: wrfull 0 0 0 0 OUTPUT NODEFVAL "wrfull"
 // Retrieval info: USED_PORT: wrreq 0 0 0 0 INPUT NODEFVAL "wrreq"
 // Retrieval info: USED_PORT: wrusedw 0 0 12 0 OUTPUT NODEFVAL "wrusedw[11..0]"
-// Retrieval info: CONNECT: @data 0 0 28 0 data 0 0 28 0
+// Retrieval info: CONNECT: @data 0 0 18 0 data 0 0 18 0
 // Retrieval info: CONNECT: @rdclk 0 0 0 0 rdclk 0 0 0 0
 // Retrieval info: CONNECT: @rdreq 0 0 0 0 rdreq 0 0 0 0
 // Retrieval info: CONNECT: @wrclk 0 0 0 0 wrclk 0 0 0 0
 // Retrieval info: CONNECT: @wrreq 0 0 0 0 wrreq 0 0 0 0
-// Retrieval info: CONNECT: q 0 0 28 0 @q 0 0 28 0
+// Retrieval info: CONNECT: q 0 0 18 0 @q 0 0 18 0
 // Retrieval info: CONNECT: rdempty 0 0 0 0 @rdempty 0 0 0 0
+// Retrieval info: CONNECT: rdusedw 0 0 12 0 @rdusedw 0 0 12 0
 // Retrieval info: CONNECT: wrfull 0 0 0 0 @wrfull 0 0 0 0
 // Retrieval info: CONNECT: wrusedw 0 0 12 0 @wrusedw 0 0 12 0
 // Retrieval info: GEN_FILE: TYPE_NORMAL cache.v TRUE
@@ -15,11 +15,16 @@ module lcd1 (
     input       [ 7:0] cpu_Data_i,    // Data fromt ARM CPU
     output reg  [ 7:0] cpu_Data_o,    // Data to ARM CPU
 
-    input      [19:0] cpu_Address,    // Address input from ARM CPU
+    input      [20:0] cpu_Address,    // Address input from ARM CPU
     input             cpu_Ren,        // Read data enable, negative logic
     input             cpu_Wen,        // Write data enable, negative logic
     output            cpu_wait,       // CPU wait output, negative logic
 
+    input             reg_Wen,        // Register page write enable, positive logic
+    input             reg_Ren,        // Register page read enable, positive logic
+    output     [ 7:0] reg_Data_o,     // Register page data to ARM CPU
+    output            lcd_irq,        // Vertical blank interrupt to ARM GPIO, positive logic
+
     inout  reg [ 7:0] dram_Data,      // Bi-Directional DRAM Data port to SRAM
     output reg [11:0] dram_Address,   // Address output for DRAM
     output reg        dram_CAS,       // DRAM Column Address Strobe
@@ -59,50 +64,457 @@ always @(rdb_enb or read_rdy or reset) begin
     end
 end
 
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+// LCD Control Registers
+// The registers live in the LCD register page decoded by tabx1 (0x301FDF00), each bank of 16
+// byte registers is selected by cpu_Address[7:4] and the register by cpu_Address[3:0].
+// Registers are written at the end of the CPU write strobe, like the cache FIFO.
+//-------------------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------------------
+`define LCD_REG_BANK   4'hF         // Scanout control bank          0x301FDFF0
+`define LCD_REG_SCANL  4'h0         // Scanout base row, low byte
+`define LCD_REG_SCANH  4'h1         // Scanout base row, high bits, commits the new base
+`define LCD_REG_STAT   4'h2         // Status: bit0 = vertical blank, bit1 = flip pending,
+                                    //         bit2 = write cache empty,
+                                    //         bit3 = line fetch missed its deadline, a write clears it
+`define LCD_REG_CTRL   4'h3         // Control: bit0 = vertical blank interrupt enable,
+                                    //          bit1 = 8 bit pseudocolor through the CLUT,
+                                    //          bit2 = text mode,
+                                    //          bit3 = 2x scaled, 320x240 shown at 640x480
+`define LCD_REG_WRAPL  4'h4         // Scanout wrap rows, low byte
+`define LCD_REG_WRAPH  4'h5         // Scanout wrap rows, high bits, commits, 0 = no wrap
+`define LCD_REG_CLUTA  4'h6         // CLUT entry index
+`define LCD_REG_CLUTL  4'h7         // CLUT entry (RGB565), low byte
+`define LCD_REG_CLUTH  4'h8         // CLUT entry (RGB565), high byte, commits, increments CLUTA
+
+`define CUR_REG_BANK   4'hE         // Hardware cursor bank          0x301FDFE0
+`define CUR_REG_XL     4'h0         // Cursor X position, low byte
+`define CUR_REG_XH     4'h1         // Cursor X position, high bits
+`define CUR_REG_YL     4'h2         // Cursor Y position, low byte
+`define CUR_REG_YH     4'h3         // Cursor Y position, high bits
+`define CUR_REG_HOTX   4'h4         // Hotspot X, 0-31
+`define CUR_REG_HOTY   4'h5         // Hotspot Y, 0-31
+`define CUR_REG_CTRL   4'h6         // Control: bit0 = cursor enable
+`define CUR_REG_ADDR   4'h7         // Image byte address, 0-255
+`define CUR_REG_DATA   4'h8         // Image data, 4 pixels per byte, increments ADDR
+`define CUR_REG_C1L    4'h9         // Color 1 (RGB565), low byte
+`define CUR_REG_C1H    4'hA         // Color 1 (RGB565), high byte
+`define CUR_REG_C2L    4'hB         // Color 2 (RGB565), low byte
+`define CUR_REG_C2H    4'hC         // Color 2 (RGB565), high byte
+
+`define BLT_REG_BANK   4'hD         // 2D engine bank                0x301FDFD0
+`define BLT_REG_DCOLL  4'h0         // Destination DRAM column (byte), low byte
+`define BLT_REG_DCOLH  4'h1         // Destination DRAM column (byte), high bits
+`define BLT_REG_DROWL  4'h2         // Destination DRAM row, low byte
+`define BLT_REG_DROWH  4'h3         // Destination DRAM row, high bits
+`define BLT_REG_SCOLL  4'h4         // Source DRAM column (byte), low byte
+`define BLT_REG_SCOLH  4'h5         // Source DRAM column (byte), high bits
+`define BLT_REG_SROWL  4'h6         // Source DRAM row, low byte
+`define BLT_REG_SROWH  4'h7         // Source DRAM row, high bits
+`define BLT_REG_WIDL   4'h8         // Width in bytes, low byte
+`define BLT_REG_WIDH   4'h9         // Width in bytes, high bits
+`define BLT_REG_HGTL   4'hA         // Height in rows, low byte
+`define BLT_REG_HGTH   4'hB         // Height in rows, high bits
+`define BLT_REG_COLL   4'hC         // Fill color (RGB565), low byte
+`define BLT_REG_COLH   4'hD         // Fill color (RGB565), high byte
+`define BLT_REG_CMD    4'hE         // Command: bit0 = fill, bit1 = copy, bit2 = reverse,
+                                    //          bit3 = expand, bit4 = RLE decode, starts it
+`define BLT_REG_STAT   4'hF         // Status: bit0 = busy
+
+`define EXP_REG_BANK   4'hC         // Color expansion bank          0x301FDFC0
+`define EXP_REG_BGL    4'h0         // Background color (RGB565), low byte
+`define EXP_REG_BGH    4'h1         // Background color (RGB565), high byte
+`define EXP_REG_ADDRL  4'h2         // Bitmap byte address, low byte
+`define EXP_REG_ADDRH  4'h3         // Bitmap byte address, high bit
+`define EXP_REG_DATA   4'h4         // Bitmap data, 8 pixels per byte, increments ADDR
+
+`define TXT_REG_BANK   4'hB         // Text mode font bank           0x301FDFB0
+`define TXT_REG_ADDRL  4'h0         // Font byte address (char * 16 + line), low byte
+`define TXT_REG_ADDRH  4'h1         // Font byte address, high bits
+`define TXT_REG_DATA   4'h2         // Font data, leftmost pixel in bit 7, increments ADDR
+
+`define STR_REG_BANK   4'h8         // Streaming port bank           0x301FDF80
+`define STR_REG_PTRL   4'h0         // Stream DRAM address, low byte
+`define STR_REG_PTRM   4'h1         // Stream DRAM address, middle byte
+`define STR_REG_PTRH   4'h2         // Stream DRAM address, high bits, commits, restarts the stream
+`define STR_REG_LEFTL  4'h4         // Column the stream goes back to on the next row, low byte
+`define STR_REG_LEFTH  4'h5         // Left column, high bits
+`define STR_REG_RIGHTL 4'h6         // Column the stream wraps at, low byte, 0 = run on linearly
+`define STR_REG_RIGHTH 4'h7         // Right column, high bits
+`define STR_WINDOW     9'h1F0       // Stream data window            0x301F0000 - 0x301F0FFF
+
+`define RLE_REG_BANK   4'h9         // RLE stream bank               0x301FDF90
+`define RLE_REG_ADDRL  4'h0         // Stream byte address, low byte
+`define RLE_REG_ADDRH  4'h1         // Stream byte address, high bits
+`define RLE_REG_DATA   4'h2         // Stream data, increments ADDR
+
+`define OVL_REG_BANK   4'hA         // YUV overlay bank              0x301FDFA0
+`define OVL_REG_XL     4'h0         // Window X on the screen, low byte
+`define OVL_REG_XH     4'h1         // Window X, high bits
+`define OVL_REG_YL     4'h2         // Window Y on the screen, low byte
+`define OVL_REG_YH     4'h3         // Window Y, high bits
+`define OVL_REG_WL     4'h4         // Window width in pixels, even, low byte
+`define OVL_REG_WH     4'h5         // Window width, high bits
+`define OVL_REG_HL     4'h6         // Window height in lines, low byte
+`define OVL_REG_HH     4'h7         // Window height, high bits
+`define OVL_REG_ROWL   4'h8         // Source DRAM row of the first Y (or YUYV) line, low byte
+`define OVL_REG_ROWH   4'h9         // Source row, high bits, commits, taken at vblank
+`define OVL_REG_CROWL  4'hA         // Planar source DRAM row of the first U/V line, low byte
+`define OVL_REG_CROWH  4'hB         // Planar chroma row, high bits, commits, taken at vblank
+`define OVL_REG_CTRL   4'hC         // Control: bit0 = overlay enable, bit1 = planar 4:2:0
+
+`define PRF_REG_BANK   4'h6         // Performance counter bank      0x301FDF60
+`define PRF_REG_CTRL   4'h0         // Control: bit0 = snapshot all counters, bit1 = clear all counters
+`define PRF_REG_SEL    4'h1         // Snapshot counter to read, see PRF_CNT_*
+`define PRF_REG_VAL0   4'h4         // Selected snapshot, bits 7:0
+`define PRF_REG_VAL1   4'h5         // Selected snapshot, bits 15:8
+`define PRF_REG_VAL2   4'h6         // Selected snapshot, bits 23:16
+`define PRF_REG_VAL3   4'h7         // Selected snapshot, bits 31:24
+`define PRF_CNT_WRITE  3'd0         // CPU bytes written through the FIFO
+`define PRF_CNT_READ   3'd1         // CPU bytes read
+`define PRF_CNT_WAIT   3'd2         // 100MHz clocks with cpu_wait raised
+`define PRF_CNT_PEAK   3'd3         // Highest write FIFO occupancy
+`define PRF_CNT_MISS   3'd4         // Line fetches that missed their deadline
+`define PRF_CNT_REFR   3'd5         // DRAM refresh cycles
+`define PRF_CNT_IDLE   3'd6         // 100MHz clocks the DRAM had no work
+
+`define TIM_REG_BANK   4'h7         // Display timing bank           0x301FDF70
+`define TIM_REG_HACTL  4'h0         // Active pixels per line, low byte
+`define TIM_REG_HACTH  4'h1         // Active pixels, high bits
+`define TIM_REG_HTOTL  4'h2         // Total pixels per line, porches and sync included, low byte
+`define TIM_REG_HTOTH  4'h3         // Total pixels, high bits
+`define TIM_REG_VACTL  4'h4         // Active lines per frame, low byte
+`define TIM_REG_VACTH  4'h5         // Active lines, high bits
+`define TIM_REG_VTOTL  4'h6         // Total lines per frame, low byte
+`define TIM_REG_VTOTH  4'h7         // Total lines, high bits
+`define TIM_REG_DIV    4'h8         // Pixel clock: 0 = 25MHz, 1 = 12.5MHz, 2 = 6.25MHz,
+                                    //   commits the timing, taken at the end of the frame
+
+//-------------------------------------------------------------------------------------------------
+// Scanout base row for page flipping. The CPU stages the low byte, writing the high byte
+// commits the new base and it is picked up at the start of the next frame, so a flip never
+// tears. A 16 bit store from the CPU writes both bytes in order.
+// The display wraps back to row 0 once it runs past ScanWrap rows, so the base can start
+// anywhere in the buffer and scrolling is just a change of base (y-wrap).
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] ScanLow;                        // Staged low byte
+reg  [ 9:0] ScanNext;                       // Committed base row, used from the next frame
+reg  [ 9:0] ScanBase;                       // Base row of the frame being displayed
+reg  [ 9:0] ScanWrap;                       // Rows in the wrap buffer, 0 = no wrap
+wire        ScanPend = (ScanNext != ScanBase);                      // Flip not taken yet
+wire [10:0] ScanSum  = (Scale2 ? {1'b0, CounterV[9:1]} : CounterV) + ScanBase;   // Unwrapped row
+wire        ScanOver = (ScanWrap != 10'd0) && (ScanSum >= {1'b0, ScanWrap});
+wire [ 9:0] ScanRow  = ScanOver ? (ScanSum - ScanWrap) : ScanSum;  // DRAM row to fetch
+
+wire        reg_wrclk = ~reg_Wen;                                   // Register write clock
+wire        lcd_bank  = (cpu_Address[7:4] == `LCD_REG_BANK);        // Scanout bank select
+wire [ 7:0] lcd_stat  = {4'b0, FetchMiss, cache_empty & ~HoldPend & WrIdle, ScanPend, ~lcd_vsync};   // Status register
+reg         MissClr;                                                // Toggled by a STAT write
+reg  [ 7:0] lcd_ctrl;                                               // Control register
+wire        Pal8      = lcd_ctrl[1];                                // 8 bit pseudocolor mode
+wire        Text      = lcd_ctrl[2];                                // Text mode
+wire        Scale2    = lcd_ctrl[3];                                // 2x pixel and line replication
+reg  [ 7:0] ClutAddr;                                               // CLUT write index
+reg  [ 7:0] ClutLow;                                                // Staged CLUT low byte, not shared with SCAN/WRAP
+wire        cur_bank  = (cpu_Address[7:4] == `CUR_REG_BANK);        // Cursor bank select
+wire        blt_bank  = (cpu_Address[7:4] == `BLT_REG_BANK);        // 2D engine bank select
+wire        exp_bank  = (cpu_Address[7:4] == `EXP_REG_BANK);        // Color expansion bank select
+wire        txt_bank  = (cpu_Address[7:4] == `TXT_REG_BANK);        // Text mode font bank select
+wire        ovl_bank  = (cpu_Address[7:4] == `OVL_REG_BANK);        // YUV overlay bank select
+wire        rle_bank  = (cpu_Address[7:4] == `RLE_REG_BANK);        // RLE stream bank select
+wire        str_bank  = (cpu_Address[7:4] == `STR_REG_BANK);        // Streaming port bank select
+wire        tim_bank  = (cpu_Address[7:4] == `TIM_REG_BANK);        // Display timing bank select
+wire        prf_bank  = (cpu_Address[7:4] == `PRF_REG_BANK);        // Performance counter bank select
+
+assign reg_Data_o = lcd_bank ? lcd_reg_q :              // Register page read data
+                    cur_bank ? cur_reg_q :
+                    blt_bank ? blt_reg_q :
+                    exp_bank ? exp_reg_q :
+                    txt_bank ? txt_reg_q :
+                    ovl_bank ? ovl_reg_q :
+                    rle_bank ? rle_reg_q :
+                    tim_bank ? tim_reg_q :
+                    prf_bank ? prf_reg_q : 8'h55;
+
+wire [ 7:0] lcd_reg_q = (cpu_Address[3:0] == `LCD_REG_SCANL)   ? ScanNext[7:0]   :
+                    (cpu_Address[3:0] == `LCD_REG_SCANH)   ? {6'b0, ScanNext[9:8]} :
+                    (cpu_Address[3:0] == `LCD_REG_STAT)    ? lcd_stat        :
+                    (cpu_Address[3:0] == `LCD_REG_CTRL)    ? lcd_ctrl        :
+                    (cpu_Address[3:0] == `LCD_REG_WRAPL)   ? ScanWrap[7:0]   :
+                    (cpu_Address[3:0] == `LCD_REG_WRAPH)   ? {6'b0, ScanWrap[9:8]} :
+                    (cpu_Address[3:0] == `LCD_REG_CLUTA)   ? ClutAddr        : 8'h55;
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        ScanLow  <=  8'd0;
+        ScanNext <= 10'd0;
+        ScanWrap <= 10'd0;
+        lcd_ctrl <=  8'd0;
+        ClutAddr <=  8'd0;
+        ClutLow  <=  8'd0;
+        MissClr  <=  1'b0;
+    end
+    else if(lcd_bank) begin
+        case(cpu_Address[3:0])
+            `LCD_REG_SCANL: ScanLow  <= cpu_Data_i;
+            `LCD_REG_STAT:  MissClr  <= ~MissClr;
+            `LCD_REG_SCANH: ScanNext <= {cpu_Data_i[1:0], ScanLow};
+            `LCD_REG_CTRL:  lcd_ctrl <= cpu_Data_i;
+            `LCD_REG_WRAPL: ScanLow  <= cpu_Data_i;
+            `LCD_REG_WRAPH: ScanWrap <= {cpu_Data_i[1:0], ScanLow};
+            `LCD_REG_CLUTA: ClutAddr <= cpu_Data_i;
+            `LCD_REG_CLUTL: ClutLow  <= cpu_Data_i;
+            `LCD_REG_CLUTH: ClutAddr <= ClutAddr + 8'd1;
+            default: ;
+        endcase
+    end
+end
+
+//-------------------------------------------------------------------------------------------------
+// Vertical blank interrupt, follows the blanking interval once CounterV passes DispHeight. The
+// AT91 PIO interrupts on both edges, the driver counts the rising one.
+//-------------------------------------------------------------------------------------------------
+assign lcd_irq = lcd_ctrl[0] & ~lcd_vsync;
+
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
 // Address Translation
+// LinearPitch = 1: The CPU sees the DRAM directly with a 2048 byte pitch, the row address
+//                  is cpu_Address[20:11] and the column address is cpu_Address[10:0]
+// LinearPitch = 0: 1280 byte CPU lines are remapped onto the 2048 byte DRAM rows
 // row col Byte CPU Address            DRAM Address translated
 //  0, 638 H:   00000000001001111110 - 000000000 01001111110
 //                                     987654321 09876543210
 //                                     111111111 10000000000 
 //                                               
+// Must match TRANSLATE_ADDRESS in sfb.h
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
+parameter LinearPitch  = 1;                         // 1 = 2048 byte linear pitch, 0 = 1280 byte lines
+
 wire [11:0] col_address = {1'b0, q_col};
-wire [11:0] row_address = {3'b0, q_row[8:0]};
+wire [11:0] row_address = {2'b0, q_row[9:0]};
 wire [19:0] q_row;
 wire [10:0] q_col;
-div div_u1(.denom(11'd1280),.numer(cpu_Address),.quotient(q_row),.remain(q_col));
+generate
+    if(LinearPitch) begin : row_u1                  // Just split the address bits
+        assign q_row = {10'd0, cpu_Address[20:11]};
+        assign q_col = cpu_Address[10:0];
+    end
+    else begin : row_u1                             // Divide down 1280 byte lines, 1MB only
+        div div_u1(.denom(11'd1280),.numer(cpu_Address[19:0]),.quotient(q_row),.remain(q_col));
+    end
+endgenerate
 
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
 // CPU write through cache 
+// The FIFO holds data only, a byte pair per entry {run, pair, high byte, low byte}. Addresses go
+// into a second, small FIFO once per run: an entry that does not follow on from the one before
+// it sets run and pushes its address there in the same clock, the drain takes the address for
+// a run entry and counts up from it for the rest. Sequential and streamed writes so carry no
+// address at all, a scattered write costs one entry in each FIFO.
+// The CPU write strobe only puts {address, byte} into a four slot ring. Its Gray coded write
+// pointer is the request, it crosses to the DRAM clock through two flops, and the combiner's
+// read pointer is the acknowledge, freeing the slot. The combiner runs on the DRAM clock and
+// keeps the last byte back, the next byte either completes it as a pair (address + 1 in the
+// same DRAM row) or pushes it alone and is kept back itself, so a 16-bit pixel is one entry and
+// a single DRAM row/column cycle with a page mode second column. The held byte is pushed alone
+// on any CPU read or register access, or once no byte came for HoldMax clocks.
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
-wire [27:0] cache_input = {cpu_Address, cpu_Data_i};
+parameter HoldMax      = 4'd15;                     // Clocks a byte waits for its pair
+
+wire [20:0] wr_addr_in  = strm_win ? StrmCur : cpu_Address;     // Address of this byte
+wire 			wrb_clk 		= ~cpu_Wen;   					// CPU write byte clock
+reg  [20:0] RingAddr [0:3];                 // Written bytes on their way to the DRAM clock
+reg  [ 7:0] RingData [0:3];
+reg  [ 1:0] RingWr;                         // Write pointer, Gray coded, the request
+reg         WrTgl;                          // Toggled by every CPU write
+
+always @(posedge wrb_clk or posedge reset) begin
+    if(reset) begin
+        RingWr <= 2'b00;
+        WrTgl  <= 1'b0;
+    end
+    else begin
+        WrTgl <= ~WrTgl;
+        if(!strm_drop) begin                // Stream write without a stream is dropped
+            RingAddr[RingWr] <= wr_addr_in;
+            RingData[RingWr] <= cpu_Data_i;
+            RingWr <= {RingWr[0], ~RingWr[1]};      // 00 01 11 10
+        end
+    end
+end
+
+reg  [ 1:0] RingS1, RingS2;                 // Write pointer into the DRAM clock
+reg  [ 1:0] RingRd;                         // Read pointer, the acknowledge
+reg  [ 1:0] AccSync;                        // Read or register access into the DRAM clock
+reg  [20:0] HoldAddr;                       // Byte kept back by the combiner
+reg  [ 7:0] HoldData;
+reg         HoldValid;                      // Something was kept back
+reg  [ 3:0] HoldAge;                        // Clocks since the byte was kept back
+reg  [20:0] RunNext;                        // Address the drain counts to after the last entry
+reg         RunValid;                       // An entry was pushed since reset
+reg  [17:0] cache_input;
+reg  [20:0] run_input;
+reg         cache_wr;                       // Push cache_input this clock
+reg         run_wr;                         // Push run_input as well, a run starts
+reg         WrWait;                         // FIFOs nearly full, registered
+wire        RingNew  = (RingS2 != RingRd);                      // A byte is waiting in the ring
+wire [20:0] NewAddr  = RingAddr[RingRd];
+wire [ 7:0] NewData  = RingData[RingRd];
+wire        NewPair  = HoldValid & (NewAddr == HoldAddr + 21'd1) & (LinearPitch != 0) & (HoldAddr[10:0] != 11'h7FF);
+wire        RunStart = ~RunValid | (HoldAddr != RunNext);       // Entry needs its address sent
+wire        HoldPend = HoldValid | RingNew | cache_wr;  // Combiner has bytes not in the FIFO yet
+
 wire        cache_full;
 wire [11:0] cache_wrdw;
-wire        wr_wait     = (cache_wrdw > 12'hFFA) & cpu_Wen;
-wire 			wrb_clk 		= ~cpu_Wen;   					// CPU write byte clock
-wire 			wrb_cs  		= 1'b1;                  	// CPU write byte Chip select
+wire [11:0] cache_rddw;                     // FIFO occupancy on the DRAM clock
+wire [ 8:0] run_wrdw;
+wire        wr_wait     = WrWait & cpu_Wen;
 
-wire [27:0] cache_q;	
+wire [17:0] cache_q;	
 wire        cache_empty;
 reg         cache_req;
+wire [20:0] run_q;                          // Address of the next run, shown ahead
+wire        run_empty;
+reg         run_req;
 
 cache	cache_u1(
 	.data    ( cache_input ),
 	.wrfull  ( cache_full ),
    .wrusedw ( cache_wrdw ),
-	.wrclk   ( wrb_clk ),
-	.wrreq   ( wrb_cs ),
+	.wrclk   ( clk_100 ),
+	.wrreq   ( cache_wr ),
 
 	.rdclk   ( clk_100 ),
 	.rdreq   ( cache_req ),
 	.q       ( cache_q ),
-	.rdempty ( cache_empty )
+	.rdempty ( cache_empty ),
+	.rdusedw ( cache_rddw )
 	);  
+
+cache_run	cache_u2(
+	.data    ( run_input ),
+	.wrfull  ( ),
+   .wrusedw ( run_wrdw ),
+	.wrclk   ( clk_100 ),
+	.wrreq   ( run_wr ),
+
+	.rdclk   ( clk_100 ),
+	.rdreq   ( run_req ),
+	.q       ( run_q ),
+	.rdempty ( run_empty ),
+	.rdusedw ( )
+	);  
+
+always @(posedge clk_100) begin
+    if(reset) begin
+        RingS1    <= 2'b00;
+        RingS2    <= 2'b00;
+        RingRd    <= 2'b00;
+        AccSync   <= 2'b00;
+        HoldValid <= 1'b0;
+        RunValid  <= 1'b0;
+        cache_wr  <= 1'b0;
+        run_wr    <= 1'b0;
+        WrWait    <= 1'b0;
+    end
+    else begin
+        RingS1   <= RingWr;
+        RingS2   <= RingS1;
+        AccSync  <= {AccSync[0], read_req | reg_Wen | reg_Ren};
+        WrWait   <= (cache_wrdw > 12'hFF0) | (run_wrdw > 9'h1F0);  // Room for the ring and the pipe
+        cache_wr <= 1'b0;
+        run_wr   <= 1'b0;
+        if(HoldAge != 4'hF) HoldAge <= HoldAge + 4'd1;
+        if(RingNew) begin                   // Next byte, pair it or push the held one
+            RingRd <= {RingRd[0], ~RingRd[1]};
+            if(HoldValid) begin
+                cache_input <= NewPair ? {RunStart, 1'b1, NewData, HoldData} : {RunStart, 1'b0, 8'h00, HoldData};
+                run_input   <= HoldAddr;
+                cache_wr    <= 1'b1;
+                run_wr      <= RunStart;
+                RunValid    <= 1'b1;
+                RunNext     <= HoldAddr + (NewPair ? 21'd2 : 21'd1);
+            end
+            if(NewPair) HoldValid <= 1'b0;  // Pair pushed, nothing kept back
+            else begin                      // Keep this byte back
+                HoldValid <= 1'b1;
+                HoldAddr  <= NewAddr;
+                HoldData  <= NewData;
+                HoldAge   <= 4'd0;
+            end
+        end
+        else if(HoldValid && (AccSync[1] || HoldAge == HoldMax)) begin  // Push the held byte alone
+            cache_input <= {RunStart, 1'b0, 8'h00, HoldData};
+            run_input   <= HoldAddr;
+            cache_wr    <= 1'b1;
+            run_wr      <= RunStart;
+            RunValid    <= 1'b1;
+            RunNext     <= HoldAddr + 21'd1;
+            HoldValid   <= 1'b0;
+        end
+    end
+end
+
+reg  [20:0] DrainAddr;                      // Address a FIFO entry without run goes to
+wire [20:0] drain_a = cache_q[17] ? run_q : DrainAddr;  // Address of this entry
+
+//-------------------------------------------------------------------------------------------------
+// Streaming port. The CPU sets a start address in the DRAM layout (row * 2048 + column) and the
+// columns of a rectangle once, then writes the bytes anywhere in the 4K window in order, with
+// ldm/stm bursts. Each byte goes into the cache FIFO with the address the stream pointer has
+// reached, the pointer steps along the row and at the right column goes down to the left column
+// of the next row. The pointer runs on the CPU write clock like the FIFO input, a commit is picked
+// up by the first stream write after it, so setting up and streaming never race. The pointer is
+// in the DRAM layout, which the drain would translate again with LinearPitch = 0, so the window
+// drops its writes there and the driver leaves the port unused.
+//-------------------------------------------------------------------------------------------------
+reg  [15:0] StrmLow;                        // Staged low bytes
+reg  [20:0] StrmStart;                      // Committed start address
+reg  [10:0] StrmLeft;                       // Column each new row starts at
+reg  [10:0] StrmRight;                      // Column the stream wraps at, 0 = none
+reg         StrmLoad;                       // Toggled by a commit
+reg         StrmSeen;                       // Follows StrmLoad once the stream restarted
+reg  [20:0] StrmPtr;                        // Address of the next stream byte
+wire        strm_win = (cpu_Address[20:12] == `STR_WINDOW);             // Stream window write
+wire        strm_drop = strm_win & (LinearPitch == 0);  // StrmCur is a DRAM address, not a CPU one
+wire [20:0] StrmCur  = (StrmLoad != StrmSeen) ? StrmStart : StrmPtr;    // Address of this byte
+wire        StrmWrap = (StrmRight != 11'd0) && (StrmCur[10:0] + 11'd1 == StrmRight);
+wire [20:0] StrmNext = StrmWrap ? {StrmCur[20:11] + 10'd1, StrmLeft} : StrmCur + 21'd1;
+
+always @(posedge wrb_clk or posedge reset) begin
+    if(reset) StrmSeen <= 1'b0;
+    else if(strm_win) begin                 // Step the pointer along with the FIFO write
+        StrmSeen <= StrmLoad;
+        StrmPtr  <= StrmNext;
+    end
+end
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        StrmLow  <= 16'd0;
+        StrmLoad <=  1'b0;
+    end
+    else if(str_bank) begin
+        case(cpu_Address[3:0])
+            `STR_REG_PTRL:   StrmLow[ 7:0] <= cpu_Data_i;
+            `STR_REG_PTRM:   StrmLow[15:8] <= cpu_Data_i;
+            `STR_REG_PTRH:   begin
+                                 StrmStart <= {cpu_Data_i[4:0], StrmLow};
+                                 StrmLoad  <= ~StrmLoad;
+                             end
+            `STR_REG_LEFTL:  StrmLow[ 7:0] <= cpu_Data_i;
+            `STR_REG_LEFTH:  StrmLeft      <= {cpu_Data_i[2:0], StrmLow[7:0]};
+            `STR_REG_RIGHTL: StrmLow[ 7:0] <= cpu_Data_i;
+            `STR_REG_RIGHTH: StrmRight     <= {cpu_Data_i[2:0], StrmLow[7:0]};
+            default: ;
+        endcase
+    end
+end
 	
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
@@ -110,12 +522,23 @@ cache	cache_u1(
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
 wire [ 7:0] cache_data = cache_q[ 7: 0];        // Cache output Data 
+wire [ 7:0] cache_hi   = cache_q[15: 8];        // Second byte of a pair
+wire        cache_pair = cache_q[16];
+wire        cache_run  = cache_q[17];           // Address comes from the run FIFO
 wire [11:0] cache_col  = {1'b0, ca_q_col};
-wire [11:0] cache_row  = {3'b0, ca_q_row[8:0]};
+wire [11:0] cache_row  = {2'b0, ca_q_row[9:0]};
 
 wire [19:0] ca_q_row;
 wire [10:0] ca_q_col;
-div div_u2(.denom(11'd1280),.numer(cache_q[27: 8]),.quotient(ca_q_row),.remain(ca_q_col));
+generate
+    if(LinearPitch) begin : row_u2                  // Just split the address bits
+        assign ca_q_row = {10'd0, drain_a[20:11]};
+        assign ca_q_col = drain_a[10:0];
+    end
+    else begin : row_u2                             // Divide down 1280 byte lines, 1MB only
+        div div_u2(.denom(11'd1280),.numer(drain_a[19:0]),.quotient(ca_q_row),.remain(ca_q_col));
+    end
+endgenerate
 
 //-------------------------------------------------------------------------------------------------
 //  LCD driving - Horizaontal and verical sync pulses
@@ -124,24 +547,92 @@ parameter Red          = 2'b00;                     // Red pane
 parameter Green        = 2'b01;                     // Green pane
 parameter Blue         = 2'b10;                     // Blue pane
 
-parameter DispWidth    = 640;                       // Set to Width  of display frame being used
-parameter DispHeight   = 480;                       // Set to Width  of display frame being used
+parameter DispWidth    = 640;                       // Set to Width  of display frame being used, reset timing
+parameter DispHeight   = 480;                       // Set to Width  of display frame being used, reset timing
 
 parameter DataWidth    = DispWidth*2;               // Set to Width  of display frame being used
 parameter DataHeight   = 480;                       // Set to Width  of display frame being used
 
-parameter FrameWidth   = 800;                       // Set to Width  of display frame being used
-parameter FrameHeight  = 525;                       // Set to Height of display frame being used
+parameter TextCols     = DispWidth/8;               // Text mode character cells across
+parameter TextRows     = DispHeight/16;             // Text mode character cells down
+parameter TextWidth    = TextCols*2;                // Text mode bytes fetched per row
+
+parameter FrameWidth   = 800;                       // Set to Width  of display frame being used, reset timing
+parameter FrameHeight  = 525;                       // Set to Height of display frame being used, reset timing
+parameter PixDivide    = 2;                         // Reset pixel clock, 6.25MHz, 15Hz
+parameter FetchMargin  = 40;                        // Latest line fetch start, pixels before the line ends
+parameter RefForce     = 64;                        // Refreshes owed before one is forced in active video
 
 parameter HSyncLow     = DispWidth-1;               // Horz count for Sync to go low
 parameter HSyncHigh    = FrameWidth-1;              // Horz count for Sync to go high
 parameter VSyncLow     = DispHeight-1;              // Vert count for Sync to go low
 parameter VSyncHigh    = FrameHeight-1;             // Vert count for Sync to go high
 
-wire      CounterHmaxed= (CounterH == FrameWidth-1);   // Frame Width
-wire      CounterVmaxed= (CounterV == FrameHeight-1);  // Frame Height
-wire      lcd_hsync    = (CounterH < DispWidth);       // HSync low
-wire      lcd_vsync    = (CounterV < DispHeight);      // VSync low
+//-------------------------------------------------------------------------------------------------
+// Display timing registers. The CPU stages active and total sizes and the pixel clock divider,
+// writing DIV commits them and the counters take them at the end of the frame, so the refresh
+// rate can be traded against DRAM time for the CPU without a new bitstream. The panel only
+// needs DE, the porches are whatever the totals leave around the active area.
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] TimLow;                         // Staged low byte
+reg  [ 9:0] TimHAct, TimHTot, TimVAct, TimVTot;     // Staged timing
+reg  [ 9:0] TimHActN, TimHTotN, TimVActN, TimVTotN; // Committed timing, used from the next frame
+reg  [ 1:0] TimDivN;
+reg  [ 9:0] DispW;                          // Timing of the frame being displayed
+reg  [ 9:0] DispH;
+reg  [ 9:0] FrameW;
+reg  [ 9:0] FrameH;
+reg  [ 1:0] PixDiv;
+
+wire [ 7:0] tim_reg_q = (cpu_Address[3:0] == `TIM_REG_HACTL) ? TimHActN[7:0] :
+                        (cpu_Address[3:0] == `TIM_REG_HACTH) ? {6'b0, TimHActN[9:8]} :
+                        (cpu_Address[3:0] == `TIM_REG_HTOTL) ? TimHTotN[7:0] :
+                        (cpu_Address[3:0] == `TIM_REG_HTOTH) ? {6'b0, TimHTotN[9:8]} :
+                        (cpu_Address[3:0] == `TIM_REG_VACTL) ? TimVActN[7:0] :
+                        (cpu_Address[3:0] == `TIM_REG_VACTH) ? {6'b0, TimVActN[9:8]} :
+                        (cpu_Address[3:0] == `TIM_REG_VTOTL) ? TimVTotN[7:0] :
+                        (cpu_Address[3:0] == `TIM_REG_VTOTH) ? {6'b0, TimVTotN[9:8]} :
+                        (cpu_Address[3:0] == `TIM_REG_DIV)   ? {6'b0, TimDivN} : 8'h55;
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        TimLow   <= 8'd0;
+        TimHAct  <= DispWidth;
+        TimHTot  <= FrameWidth;
+        TimVAct  <= DispHeight;
+        TimVTot  <= FrameHeight;
+        TimHActN <= DispWidth;
+        TimHTotN <= FrameWidth;
+        TimVActN <= DispHeight;
+        TimVTotN <= FrameHeight;
+        TimDivN  <= PixDivide;
+    end
+    else if(tim_bank) begin
+        case(cpu_Address[3:0])
+            `TIM_REG_HACTL: TimLow  <= cpu_Data_i;
+            `TIM_REG_HACTH: TimHAct <= {cpu_Data_i[1:0], TimLow};
+            `TIM_REG_HTOTL: TimLow  <= cpu_Data_i;
+            `TIM_REG_HTOTH: TimHTot <= {cpu_Data_i[1:0], TimLow};
+            `TIM_REG_VACTL: TimLow  <= cpu_Data_i;
+            `TIM_REG_VACTH: TimVAct <= {cpu_Data_i[1:0], TimLow};
+            `TIM_REG_VTOTL: TimLow  <= cpu_Data_i;
+            `TIM_REG_VTOTH: TimVTot <= {cpu_Data_i[1:0], TimLow};
+            `TIM_REG_DIV:   begin
+                                TimHActN <= TimHAct;
+                                TimHTotN <= TimHTot;
+                                TimVActN <= TimVAct;
+                                TimVTotN <= TimVTot;
+                                TimDivN  <= (cpu_Data_i[1:0] == 2'd3) ? 2'd2 : cpu_Data_i[1:0];
+                            end
+            default: ;
+        endcase
+    end
+end
+
+wire      CounterHmaxed= (CounterH == FrameW-1);       // Frame Width
+wire      CounterVmaxed= (CounterV == FrameH-1);       // Frame Height
+wire      lcd_hsync    = (CounterH < DispW);           // HSync low
+wire      lcd_vsync    = (CounterV < DispH);           // VSync low
 assign    lcd_de       = lcd_hsync & lcd_vsync;        // LCD Data enable line
 assign    lcd_xclk     = xclk;                         // LCD pixel clock
 
@@ -151,12 +642,15 @@ reg  [9:0] CounterV;                                // For Vertical
 //-------------------------------------------------------------------------------------------------
 //  Pixel Clock Generation:
 //  Frame Rate = (pclk  / divisor / Frame Width / Frame Height
-//       60hz = 25Mhz / 1       / 800         / 525              xclk = CounterP;    (25.00 Mhz)
+//       60hz = 25Mhz / 1       / 800         / 525              xclk = pclk;        (25.00 Mhz)
 //       30hz = 25Mhz / 2       / 800         / 525              xclk = CounterP[0]; (12.50 Mhz) 
 //       15hz = 25Mhz / 4       / 800         / 525              xclk = CounterP[1]; ( 6.25 Mhz)
+// The divider only changes at the end of a frame. The CLUT, text and overlay lookups stay on
+// pclk, at 25MHz they land a pixel late instead of a quarter pixel.
 //-------------------------------------------------------------------------------------------------
 reg  [1:0] CounterP;                                // For dividing clock speed down
-wire   xclk     =  CounterP[1];                     // Divide main clock down for pixel rate
+wire   xclk     =  (PixDiv == 2'd0) ? pclk :        // Divide main clock down for pixel rate
+                   (PixDiv == 2'd1) ? CounterP[0] : CounterP[1];
 always @(posedge pclk) CounterP <= CounterP + 2'b1; // increment pixel counter
 
 always @(posedge xclk) begin
@@ -169,6 +663,25 @@ always @(posedge xclk) begin                        // Always for vertical count
         else              CounterV <= CounterV + 10'd1; // Goto the next line in the frame
     end
 end
+always @(posedge xclk) begin                        // Take a committed flip at frame start
+    if(CounterHmaxed & CounterVmaxed) ScanBase <= ScanNext;
+end
+always @(posedge xclk or posedge reset) begin       // Take committed timing at frame start
+    if(reset) begin
+        DispW  <= DispWidth;
+        DispH  <= DispHeight;
+        FrameW <= FrameWidth;
+        FrameH <= FrameHeight;
+        PixDiv <= PixDivide;
+    end
+    else if(CounterHmaxed & CounterVmaxed) begin
+        DispW  <= TimHActN;
+        DispH  <= TimVActN;
+        FrameW <= TimHTotN;
+        FrameH <= TimVTotN;
+        PixDiv <= TimDivN;
+    end
+end
 
 //-------------------------------------------------------------------------------------------------
 //  Triple barrel double FIFO buffer pipeline
@@ -176,24 +689,491 @@ end
 wire         rd_clk_en     = lcd_de;                          // Read clock enable line
 wire         rd_clk        = xclk & rd_clk_en;                // Read clock opposes pixel clock
 wire         VertData      = lcd_vsync;                       // Valid Vertical data
-wire         FIFOReq       = (CounterH > FrameWidth-128);     // When to start re-loading the buffer
-wire         DRAMReq       = FIFOReq & VertData;              // DRAM request
-wire         CounterAmaxed = (dram_Address  == DataWidth-1);  // Data Width Count
+wire         FIFOReq       = (CounterH >= DispW);             // Line shown, the buffer may be re-loaded
+wire         FetchDue      = (CounterH >= FrameW - ((FetchMargin*4) >> PixDiv));   // Deadline, scanout goes before the CPU
+reg    [9:0] ScanLast;                                        // CounterV the last line fetch was started on
+wire         DRAMReq       = FIFOReq & VertData & ~(Scale2 & CounterV[0]) & (ScanLast != CounterV);   // DRAM request
+wire         CounterAmaxed = (dram_Address  == (Text ? {4'b0, DispW[9:2]} - 12'd1 :           // Bytes of the line
+                                                Pal8 ? (Scale2 ? {3'b0, DispW[9:1]} : {2'b0, DispW}) - 12'd1 :
+                                                       (Scale2 ? {2'b0, DispW} : {1'b0, DispW, 1'b0}) - 12'd1));
 
-wire   [9:0] rd_addr = CounterH[9:0];                              // Read address is lower bits of horz cntr
+//-------------------------------------------------------------------------------------------------
+// 2x scaled mode. A 320x240 frame is shown at 640x480, each pixel and each line twice. Only the
+// first half of the row is fetched, and only on even lines, the odd lines show the line buffer
+// again, so the scanout takes a quarter of the DRAM time. Cursor and overlay stay in screen pixels.
+//-------------------------------------------------------------------------------------------------
+wire   [9:0] rd_addr = Text ? {3'b0, CounterH[9:3]} :                  // Read address is lower bits of horz cntr
+                       Pal8 ? (Scale2 ? {2'b0, CounterH[9:2]} : {1'b0, CounterH[9:1]}) :
+                              (Scale2 ? {1'b0, CounterH[9:1]} : CounterH[9:0]);
 reg          wreq;                                                 // write request flag
 reg   [10:0] wr_addr;                                              // Fifo buffer write address
 wire  [15:0] lcd_data;
 ram1 RAM_u1(.rdaddress(rd_addr),.rdclock(rd_clk),.q(lcd_data),.wraddress(wr_addr),.wrclock(clk),.wren(wreq),.data(dram_Data));
 
+//-------------------------------------------------------------------------------------------------
+// 8 bit pseudocolor. Only DispWidth bytes of the row are fetched, ram1 then holds two pixels per
+// word and PixSel picks the byte latched along with the read address. The byte is looked up in
+// the 256 entry RGB565 CLUT on pclk, so the color settles a quarter pixel after lcd_data would.
+//-------------------------------------------------------------------------------------------------
+reg  [15:0] Clut [0:255];                   // Color lookup table, RGB565
+reg  [15:0] ClutQ;                          // Color of the current pixel
+reg         PixSel;                         // Odd pixel, high byte of the ram1 word
+wire [ 7:0] PixByte   = PixSel ? lcd_data[15:8] : lcd_data[7:0];
+wire [15:0] scan_data = OvlShow ? OvlQ :                           // Pixel out of the line buffer
+                       Text ? TextQ : Pal8 ? ClutQ : lcd_data;
+
+always @(posedge xclk) PixSel <= Scale2 ? CounterH[1] : CounterH[0];
+always @(posedge pclk) ClutQ  <= Clut[PixByte];
+always @(posedge reg_wrclk) begin           // CLUT RAM, kept out of the reset block
+    if(lcd_bank && (cpu_Address[3:0] == `LCD_REG_CLUTH)) Clut[ClutAddr] <= {cpu_Data_i, ClutLow};
+end
+
+//-------------------------------------------------------------------------------------------------
+// Text mode. The screen is TextCols x TextRows cells of 8x16 pixels. Each text row is one DRAM
+// row starting at the scanout base row, holding a character byte then an attribute byte per
+// cell, foreground color in the low nibble and background in the high one. Only the first
+// TextWidth bytes are fetched, ram1 then holds one cell per word. The character and the line
+// within the cell address the font RAM, and the two colors come from CLUT entries 0-15, which
+// are mirrored in registers so the lookup fits in the same pclk as the 8 bit mode CLUT. A line is
+// fetched in the blanking of the line before it is shown, so the cell row is taken for CounterV+1
+// to match the font line CounterV has moved on to by then.
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] Font [0:4095];                  // 256 characters x 16 lines
+reg  [11:0] FontAddr;                       // Font write address
+reg  [15:0] TextPal [0:15];                 // CLUT entries 0-15
+reg  [ 2:0] TextCol;                        // Pixel in the cell, latched with the ram1 address
+reg  [ 2:0] TextBit;                        // Pixel in the cell for TextFont
+reg  [ 7:0] TextFont;                       // Font line of the current cell
+reg  [ 7:0] TextAttr;                       // Attribute of the current cell
+wire [ 9:0] TextLine = CounterV + 10'd1;                            // Line the fetch is shown on
+wire [ 9:0] TextRow = ScanBase + {4'b0, TextLine[9:4]};             // DRAM row to fetch
+wire [ 3:0] TextIdx = TextFont[~TextBit] ? TextAttr[3:0] : TextAttr[7:4];
+wire [15:0] TextQ   = TextPal[TextIdx];                             // Text pixel
+
+wire [ 7:0] txt_reg_q = (cpu_Address[3:0] == `TXT_REG_ADDRL) ? FontAddr[7:0]  :
+                        (cpu_Address[3:0] == `TXT_REG_ADDRH) ? {4'b0, FontAddr[11:8]} : 8'h55;
+
+always @(posedge xclk) TextCol <= CounterH[2:0];
+always @(posedge pclk) begin
+    TextBit  <= TextCol;
+    TextFont <= Font[{lcd_data[7:0], CounterV[3:0]}];
+    TextAttr <= lcd_data[15:8];
+end
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) FontAddr <= 12'd0;
+    else if(txt_bank) begin
+        case(cpu_Address[3:0])
+            `TXT_REG_ADDRL: FontAddr[ 7:0] <= cpu_Data_i;
+            `TXT_REG_ADDRH: FontAddr[11:8] <= cpu_Data_i[3:0];
+            `TXT_REG_DATA:  FontAddr       <= FontAddr + 12'd1;
+            default: ;
+        endcase
+    end
+end
+always @(posedge reg_wrclk) begin           // Font RAM and palette copy, kept out of the reset block
+    if(txt_bank && (cpu_Address[3:0] == `TXT_REG_DATA)) Font[FontAddr] <= cpu_Data_i;
+    if(lcd_bank && (cpu_Address[3:0] == `LCD_REG_CLUTH) && (ClutAddr[7:4] == 4'h0))
+        TextPal[ClutAddr[3:0]] <= {cpu_Data_i, ClutLow};
+end
+
+//-------------------------------------------------------------------------------------------------
+// YUV overlay. A window of the screen is taken from a video frame held as YUV in spare DRAM rows
+// and converted to RGB565 at scanout, so a player moves 12-16 bits per pixel of source and skips
+// the per pixel conversion. The source has one DRAM row per line starting at column 0:
+//    packed 4:2:2  Y0 U Y1 V ... from row ROW + line
+//    planar 4:2:0  Y bytes from row ROW + line, U bytes from column 0 and V bytes from column
+//                  1024 of row CROW + line / 2
+// The lines are fetched by the DRAM state machine right after the scanout fetch, two lines ahead
+// into one half of the ping-pong line buffers while the other half is displayed. Source rows
+// are taken at vblank, so the player can flip between frames without tearing.
+// BT.601 conversion, video range, 8 bits of fraction:
+//    R = 1.164(Y-16) + 1.596(V-128)
+//    G = 1.164(Y-16) - 0.391(U-128) - 0.813(V-128)
+//    B = 1.164(Y-16) + 2.018(U-128)
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] OvlLow;                         // Staged low byte
+reg  [ 9:0] OvlX;                           // Window position
+reg  [ 9:0] OvlY;
+reg  [ 9:0] OvlW;                           // Window size
+reg  [ 9:0] OvlH;
+reg  [ 9:0] OvlRowNext;                     // Committed source rows, used from the next vblank
+reg  [ 9:0] OvlCRowNext;
+reg  [ 9:0] OvlRow;                         // Source rows of the frame being displayed
+reg  [ 9:0] OvlCRow;
+reg  [ 7:0] OvlCtrl;                        // Overlay control
+wire        OvlOn     = OvlCtrl[0];         // Overlay enabled
+wire        OvlPlanar = OvlCtrl[1];         // Planar 4:2:0, else packed 4:2:2
+
+reg  [ 7:0] OvlYBuf [0:2047];               // Line buffers, two halves
+reg  [ 7:0] OvlUBuf [0:1023];
+reg  [ 7:0] OvlVBuf [0:1023];
+reg  [ 7:0] OvlYQ;                          // Source of the current pixel
+reg  [ 7:0] OvlUQ;
+reg  [ 7:0] OvlVQ;
+reg         OvlPix;                         // Current pixel is in the window
+reg         OvlShow;                        // OvlQ holds a window pixel
+reg  signed [18:0] OvlR;                    // Converted color, 8 bits of fraction
+reg  signed [18:0] OvlG;
+reg  signed [18:0] OvlB;
+
+wire [10:0] OvlCol  = {1'b0, CounterH} - {1'b0, OvlX};                  // Pixel in the window
+wire [10:0] OvlLin  = {1'b0, CounterV} - {1'b0, OvlY};                  // Line in the window
+wire        OvlHit  = OvlOn && (OvlCol < {1'b0, OvlW}) && (OvlLin < {1'b0, OvlH});
+wire signed [9:0] OvlYs = {2'b00, OvlYQ} - 10'd16;
+wire signed [9:0] OvlUs = {2'b00, OvlUQ} - 10'd128;
+wire signed [9:0] OvlVs = {2'b00, OvlVQ} - 10'd128;
+wire [ 7:0] OvlR8   = OvlR[18] ? 8'h00 : (|OvlR[17:16]) ? 8'hFF : OvlR[15:8];   // Clamp
+wire [ 7:0] OvlG8   = OvlG[18] ? 8'h00 : (|OvlG[17:16]) ? 8'hFF : OvlG[15:8];
+wire [ 7:0] OvlB8   = OvlB[18] ? 8'h00 : (|OvlB[17:16]) ? 8'hFF : OvlB[15:8];
+wire [15:0] OvlQ    = {OvlB8[7:3], OvlG8[7:2], OvlR8[7:3]};             // Overlay pixel
+
+wire [ 7:0] ovl_reg_q = (cpu_Address[3:0] == `OVL_REG_CTRL) ? OvlCtrl : 8'h55;
+
+always @(posedge xclk) begin                // Line buffer read, lines up with lcd_data
+    OvlPix <= OvlHit;
+    OvlYQ  <= OvlYBuf[{CounterV[0], OvlCol[9:0]}];
+    OvlUQ  <= OvlUBuf[{CounterV[0], OvlCol[9:1]}];
+    OvlVQ  <= OvlVBuf[{CounterV[0], OvlCol[9:1]}];
+end
+always @(posedge pclk) begin                // Convert, settles with the CLUT lookup
+    OvlShow <= OvlPix;
+    OvlR    <= 19'sd298 * OvlYs + 19'sd409 * OvlVs;
+    OvlG    <= 19'sd298 * OvlYs - 19'sd100 * OvlUs - 19'sd208 * OvlVs;
+    OvlB    <= 19'sd298 * OvlYs + 19'sd516 * OvlUs;
+end
+always @(posedge xclk) begin                // Take committed source rows at vblank
+    if(CounterHmaxed & (CounterV == DispH-1)) begin
+        OvlRow  <= OvlRowNext;
+        OvlCRow <= OvlCRowNext;
+    end
+end
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        OvlLow  <= 8'd0;
+        OvlCtrl <= 8'd0;
+    end
+    else if(ovl_bank) begin
+        case(cpu_Address[3:0])
+            `OVL_REG_XL:    OvlLow      <= cpu_Data_i;
+            `OVL_REG_XH:    OvlX        <= {cpu_Data_i[1:0], OvlLow};
+            `OVL_REG_YL:    OvlLow      <= cpu_Data_i;
+            `OVL_REG_YH:    OvlY        <= {cpu_Data_i[1:0], OvlLow};
+            `OVL_REG_WL:    OvlLow      <= cpu_Data_i;
+            `OVL_REG_WH:    OvlW        <= {cpu_Data_i[1:0], OvlLow};
+            `OVL_REG_HL:    OvlLow      <= cpu_Data_i;
+            `OVL_REG_HH:    OvlH        <= {cpu_Data_i[1:0], OvlLow};
+            `OVL_REG_ROWL:  OvlLow      <= cpu_Data_i;
+            `OVL_REG_ROWH:  OvlRowNext  <= {cpu_Data_i[1:0], OvlLow};
+            `OVL_REG_CROWL: OvlLow      <= cpu_Data_i;
+            `OVL_REG_CROWH: OvlCRowNext <= {cpu_Data_i[1:0], OvlLow};
+            `OVL_REG_CTRL:  OvlCtrl     <= cpu_Data_i;
+            default: ;
+        endcase
+    end
+end
+
+//-------------------------------------------------------------------------------------------------
+// Overlay fetch, run by the DRAM state machine through the scanout fetch states. Pass 1 reads the
+// Y or YUYV line, passes 2 and 3 the planar U and V halves of the chroma row. Each line is fetched
+// two lines before it is displayed, the line is picked when the fetch starts since a long one
+// runs on into the next line. OvlLast keeps a line from being fetched twice.
+//-------------------------------------------------------------------------------------------------
+reg  [ 1:0] OvlPass;                        // 0 = scanout fetch, 1-3 = overlay pass
+reg  [10:0] OvlIdx;                         // Byte in the pass
+reg  [ 9:0] OvlLine;                        // Display line being fetched
+reg  [ 9:0] OvlLast;                        // CounterV the last fetch was started on
+reg         OvlDue;                         // Overlay line to fetch after the scanout line
+
+wire [ 9:0] OvlT    = (CounterV >= FrameH-2) ? CounterV - (FrameH-2) : CounterV + 10'd2;
+wire [ 9:0] OvlTLin = OvlT - OvlY;                                      // Window line of OvlT
+wire        OvlReq  = FIFOReq & OvlOn & (OvlTLin < OvlH) & (OvlLast != CounterV);   // Line due
+wire [ 9:0] OvlSrc  = OvlLine - OvlY;                                   // Source line
+wire [ 9:0] OvlFRow = (OvlPass == 2'd1) ? OvlRow + OvlSrc : OvlCRow + {1'b0, OvlSrc[9:1]};
+wire [10:0] OvlFCol = (OvlPass == 2'd3) ? 11'd1024 : 11'd0;             // First column of the pass
+wire [10:0] OvlLen  = !OvlPlanar        ? {OvlW, 1'b0} :                // Bytes in the pass
+                      (OvlPass == 2'd1) ? {1'b0, OvlW} : {2'b0, OvlW[9:1]};
+wire        OvlEnd  = (OvlIdx == OvlLen - 11'd1);                       // Last byte of the pass
+wire        OvlMore = OvlPlanar & (OvlPass != 2'd3);                    // Another pass follows
+wire        OvlCap  = (DRAMState == 6'd05) && (OvlPass != 2'd0);        // Overlay byte on the bus
+wire [ 1:0] OvlLane = OvlPlanar ? OvlPass - 2'd1 :                      // 0 = Y, 1 = U, 2 = V
+                      !OvlIdx[0] ? 2'd0 : OvlIdx[1] ? 2'd2 : 2'd1;
+wire [ 9:0] OvlWrA  = OvlPlanar ? OvlIdx[9:0] :                         // Byte in the buffer
+                      !OvlIdx[0] ? OvlIdx[10:1] : {1'b0, OvlIdx[10:2]};
+
+always @(posedge clk) begin                 // Line buffer write, kept out of the reset block
+    if(OvlCap) begin
+        case(OvlLane)
+            2'd0: OvlYBuf[{OvlLine[0], OvlWrA[9:0]}] <= dram_Data;
+            2'd1: OvlUBuf[{OvlLine[0], OvlWrA[8:0]}] <= dram_Data;
+            default: OvlVBuf[{OvlLine[0], OvlWrA[8:0]}] <= dram_Data;
+        endcase
+    end
+end
+
 //-------------------------------------------------------------------------------------------------
 // RGB565 bit layout:  1111110000000000
 //                     5432109876543210
 //                     RRRRRGGGGGGBBBBB
 //-------------------------------------------------------------------------------------------------
-assign lcd_r = {lcd_data[ 4: 0], lcd_data[ 0]};   // Red bits
-assign lcd_g =  lcd_data[10: 5];                  // Green bits
-assign lcd_b = {lcd_data[15:11], lcd_data[11]};   // Blue bits
+assign lcd_r = {pix_data[ 4: 0], pix_data[ 0]};   // Red bits
+assign lcd_g =  pix_data[10: 5];                  // Green bits
+assign lcd_b = {pix_data[15:11], pix_data[11]};   // Blue bits
+
+//-------------------------------------------------------------------------------------------------
+// Hardware cursor, a 32x32 sprite laid over the pixels coming out of ram1. The image holds 2 bits
+// per pixel, 4 pixels per byte with the leftmost pixel in the low bits, 8 bytes per line:
+//    00 = transparent, 01 = color 1, 10 = color 2, 11 = invert the screen pixel
+// The sprite origin is the position less the hotspot, it may hang off the left or top edge.
+// The image is looked up with the same CounterH the ram1 read address is latched with, and read
+// on xclk like ram1 so it sits in block RAM, the cursor pixel then lines up with scan_data.
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] CurImage [0:255];               // Cursor image, 2 bits per pixel
+reg  [ 7:0] CurAddr;                        // Image write address
+reg  [ 7:0] CurLow;                         // Staged low byte
+reg  [ 9:0] CurX;                           // Cursor position
+reg  [ 9:0] CurY;
+reg  [ 4:0] CurHotX;                        // Cursor hotspot
+reg  [ 4:0] CurHotY;
+reg  [ 7:0] CurCtrl;                        // Cursor control
+reg  [15:0] CurColor1;                      // Cursor colors
+reg  [15:0] CurColor2;
+reg  [ 7:0] CurByte;                        // Image byte for the current lcd_data
+reg  [ 1:0] CurSel;                         // Pixel in CurByte
+reg         CurOn;                          // Sprite covers the current lcd_data
+
+wire [10:0] CurCol  = {1'b0, CounterH} - ({1'b0, CurX} - {6'b0, CurHotX});  // Column in sprite
+wire [10:0] CurLin  = {1'b0, CounterV} - ({1'b0, CurY} - {6'b0, CurHotY});  // Line in sprite
+wire        CurHit  = CurCtrl[0] && (CurCol < 11'd32) && (CurLin < 11'd32);
+wire [ 7:0] CurBits = CurByte >> {CurSel, 1'b0};
+wire [ 1:0] CurPix  = CurOn ? CurBits[1:0] : 2'b00;                // Cursor pixel
+
+always @(posedge xclk) begin                // Registered read, the address goes in the M9K
+    CurByte <= CurImage[{CurLin[4:0], CurCol[4:2]}];
+    CurSel  <= CurCol[1:0];
+    CurOn   <= CurHit;
+end
+
+wire [15:0] pix_data = (CurPix == 2'b01) ? CurColor1 :                  // Pixel to the LCD
+                       (CurPix == 2'b10) ? CurColor2 :
+                       (CurPix == 2'b11) ? ~scan_data : scan_data;
+
+wire [ 7:0] cur_reg_q = (cpu_Address[3:0] == `CUR_REG_XL)   ? CurX[7:0]       :
+                        (cpu_Address[3:0] == `CUR_REG_XH)   ? {6'b0, CurX[9:8]} :
+                        (cpu_Address[3:0] == `CUR_REG_YL)   ? CurY[7:0]       :
+                        (cpu_Address[3:0] == `CUR_REG_YH)   ? {6'b0, CurY[9:8]} :
+                        (cpu_Address[3:0] == `CUR_REG_HOTX) ? {3'b0, CurHotX} :
+                        (cpu_Address[3:0] == `CUR_REG_HOTY) ? {3'b0, CurHotY} :
+                        (cpu_Address[3:0] == `CUR_REG_CTRL) ? CurCtrl         :
+                        (cpu_Address[3:0] == `CUR_REG_ADDR) ? CurAddr         : 8'h55;
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        CurAddr   <=  8'd0;
+        CurLow    <=  8'd0;
+        CurCtrl   <=  8'd0;
+    end
+    else if(cur_bank) begin
+        case(cpu_Address[3:0])
+            `CUR_REG_XL:   CurLow    <= cpu_Data_i;
+            `CUR_REG_XH:   CurX      <= {cpu_Data_i[1:0], CurLow};
+            `CUR_REG_YL:   CurLow    <= cpu_Data_i;
+            `CUR_REG_YH:   CurY      <= {cpu_Data_i[1:0], CurLow};
+            `CUR_REG_HOTX: CurHotX   <= cpu_Data_i[4:0];
+            `CUR_REG_HOTY: CurHotY   <= cpu_Data_i[4:0];
+            `CUR_REG_CTRL: CurCtrl   <= cpu_Data_i;
+            `CUR_REG_ADDR: CurAddr   <= cpu_Data_i;
+            `CUR_REG_DATA: CurAddr   <= CurAddr + 8'd1;
+            `CUR_REG_C1L:  CurLow    <= cpu_Data_i;
+            `CUR_REG_C1H:  CurColor1 <= {cpu_Data_i, CurLow};
+            `CUR_REG_C2L:  CurLow    <= cpu_Data_i;
+            `CUR_REG_C2H:  CurColor2 <= {cpu_Data_i, CurLow};
+            default: ;
+        endcase
+    end
+end
+always @(posedge reg_wrclk) begin           // Image RAM, kept out of the reset block
+    if(cur_bank && (cpu_Address[3:0] == `CUR_REG_DATA)) CurImage[CurAddr] <= cpu_Data_i;
+end
+
+//-------------------------------------------------------------------------------------------------
+// 2D engine, fills a rectangle of DRAM with a 16 bit color or copies one rectangle of DRAM to
+// another. Coordinates are DRAM rows and byte columns, which with LinearPitch are the screen
+// lines and x * 2. The CPU loads the registers and writes CMD, the DRAM state machine then works
+// through the rectangle one segment of up to 32 bytes at a time in the gaps between scanout
+// fetches, cache drains and CPU reads. A copy reads the segment into BltBuf and writes it back
+// out in the next gap. With the reverse bit the rows are walked bottom up and the segments right
+// to left, SROW and DROW then name the last row, so overlapping copies come out right.
+// Expand writes the rectangle from a 1 bit per pixel bitmap the CPU has loaded into ExpBuf,
+// set bits in the COLOR register and clear bits in the expansion bank BG color, so text costs
+// one bus byte per 8 pixels instead of 16. Bitmap rows start on a byte, most significant bit
+// is the leftmost pixel, the same layout as a Linux fb_image.
+// RLE decode writes the rectangle in raster order from a run length stream the CPU has loaded
+// into RleBuf, see below.
+// In 8 bit pseudocolor mode each byte is a pixel, the CPU puts the color index in both bytes.
+// The command is handed to the DRAM clock domain with a toggle, busy until it is acknowledged.
+// The CPU must not write pixels, load the registers or the bitmap while the engine is busy.
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] BltLow;                         // Staged low byte
+reg  [10:0] BltDstCol;                      // Destination column
+reg  [ 9:0] BltDstRow;                      // Destination row
+reg  [10:0] BltSrcCol;                      // Source column
+reg  [ 9:0] BltSrcRow;                      // Source row
+reg  [11:0] BltWidth;                       // Width in bytes
+reg  [ 9:0] BltHeight;                      // Height in rows
+reg  [15:0] BltColor;                       // Fill color
+reg  [ 7:0] BltCmd;                         // Command
+reg         BltGo;                          // Toggled by a command write
+reg  [ 1:0] BltSync;                        // BltGo synchronised to the DRAM clock
+reg         BltAck;                         // Follows BltGo when the command is done
+wire        BltBusy = (BltGo != BltAck);    // Command outstanding
+wire        BltFill = BltCmd[0];            // Fill
+wire        BltRev  = BltCmd[2];            // Walk bottom up, right to left
+wire        BltExp  = BltCmd[3];            // Expand the bitmap, else copy if not fill
+wire        BltRle  = BltCmd[4];            // Decode the RLE stream
+
+wire [ 7:0] blt_reg_q = (cpu_Address[3:0] == `BLT_REG_CMD)  ? BltCmd          :
+                        (cpu_Address[3:0] == `BLT_REG_STAT) ? {7'b0, BltBusy} : 8'h55;
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        BltLow <= 8'd0;
+        BltCmd <= 8'd0;
+        BltGo  <= 1'b0;
+    end
+    else if(blt_bank) begin
+        case(cpu_Address[3:0])
+            `BLT_REG_DCOLL: BltLow    <= cpu_Data_i;
+            `BLT_REG_DCOLH: BltDstCol <= {cpu_Data_i[2:0], BltLow};
+            `BLT_REG_DROWL: BltLow    <= cpu_Data_i;
+            `BLT_REG_DROWH: BltDstRow <= {cpu_Data_i[1:0], BltLow};
+            `BLT_REG_SCOLL: BltLow    <= cpu_Data_i;
+            `BLT_REG_SCOLH: BltSrcCol <= {cpu_Data_i[2:0], BltLow};
+            `BLT_REG_SROWL: BltLow    <= cpu_Data_i;
+            `BLT_REG_SROWH: BltSrcRow <= {cpu_Data_i[1:0], BltLow};
+            `BLT_REG_WIDL:  BltLow    <= cpu_Data_i;
+            `BLT_REG_WIDH:  BltWidth  <= {cpu_Data_i[3:0], BltLow};
+            `BLT_REG_HGTL:  BltLow    <= cpu_Data_i;
+            `BLT_REG_HGTH:  BltHeight <= {cpu_Data_i[1:0], BltLow};
+            `BLT_REG_COLL:  BltLow    <= cpu_Data_i;
+            `BLT_REG_COLH:  BltColor  <= {cpu_Data_i, BltLow};
+            `BLT_REG_CMD:   begin
+                                BltCmd <= cpu_Data_i;
+                                if(cpu_Data_i[4:0] & 5'b11011) BltGo <= ~BltGo;
+                            end
+            default: ;
+        endcase
+    end
+end
+
+//-------------------------------------------------------------------------------------------------
+// Color expansion bitmap, 512 bytes, written from the CPU side and read by the DRAM state machine
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] ExpBuf [0:511];                 // Bitmap, 1 bit per pixel
+reg  [ 8:0] ExpAddr;                        // Bitmap write address
+reg  [ 7:0] ExpLow;                         // Staged low byte
+reg  [15:0] ExpBg;                          // Background color
+
+wire [ 7:0] exp_reg_q = (cpu_Address[3:0] == `EXP_REG_ADDRL) ? ExpAddr[7:0]    :
+                        (cpu_Address[3:0] == `EXP_REG_ADDRH) ? {7'b0, ExpAddr[8]} : 8'h55;
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        ExpAddr <= 9'd0;
+        ExpLow  <= 8'd0;
+    end
+    else if(exp_bank) begin
+        case(cpu_Address[3:0])
+            `EXP_REG_BGL:   ExpLow  <= cpu_Data_i;
+            `EXP_REG_BGH:   ExpBg   <= {cpu_Data_i, ExpLow};
+            `EXP_REG_ADDRL: ExpLow  <= cpu_Data_i;
+            `EXP_REG_ADDRH: ExpAddr <= {cpu_Data_i[0], ExpLow};
+            `EXP_REG_DATA:  ExpAddr <= ExpAddr + 9'd1;
+            default: ;
+        endcase
+    end
+end
+always @(posedge reg_wrclk) begin           // Bitmap RAM, kept out of the reset block
+    if(exp_bank && (cpu_Address[3:0] == `EXP_REG_DATA)) ExpBuf[ExpAddr] <= cpu_Data_i;
+end
+
+//-------------------------------------------------------------------------------------------------
+// RLE stream, 1024 little endian 16 bit words, written a byte at a time from the CPU side. The
+// stream is a list of packets covering the rectangle in raster order, a packet never crosses a
+// row. The header word holds the pixel count less one in bits 14:0 and bit 15 set for a run:
+//    run      header, then one RGB565 color (8 bit mode: the index in the low byte)
+//    literal  header, then the pixels, RGB565 or two 8 bit indexes per word, padded to a word
+// Flat UI areas then cost 4 bus bytes per run instead of 2 per pixel.
+//-------------------------------------------------------------------------------------------------
+reg  [ 7:0] RleBufL [0:1023];               // Stream, low bytes
+reg  [ 7:0] RleBufH [0:1023];               // Stream, high bytes
+reg  [10:0] RleWAddr;                       // Stream write byte address
+reg  [ 7:0] RleLow;                         // Staged low byte
+
+wire [ 7:0] rle_reg_q = (cpu_Address[3:0] == `RLE_REG_ADDRL) ? RleWAddr[7:0]   :
+                        (cpu_Address[3:0] == `RLE_REG_ADDRH) ? {5'b0, RleWAddr[10:8]} : 8'h55;
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        RleWAddr <= 11'd0;
+        RleLow   <=  8'd0;
+    end
+    else if(rle_bank) begin
+        case(cpu_Address[3:0])
+            `RLE_REG_ADDRL: RleLow   <= cpu_Data_i;
+            `RLE_REG_ADDRH: RleWAddr <= {cpu_Data_i[2:0], RleLow};
+            `RLE_REG_DATA:  RleWAddr <= RleWAddr + 11'd1;
+            default: ;
+        endcase
+    end
+end
+always @(posedge reg_wrclk) begin           // Stream RAM, kept out of the reset block
+    if(rle_bank && (cpu_Address[3:0] == `RLE_REG_DATA)) begin
+        if(RleWAddr[0]) RleBufH[RleWAddr[10:1]] <= cpu_Data_i;
+        else            RleBufL[RleWAddr[10:1]] <= cpu_Data_i;
+    end
+end
+
+//-------------------------------------------------------------------------------------------------
+// 2D engine working state, run by the DRAM state machine
+//-------------------------------------------------------------------------------------------------
+reg         BltRun;                         // Command being worked on
+reg         BltPhase;                       // Copy: 0 = read segment, 1 = write it
+reg  [ 9:0] BltDRow;                        // Current destination row
+reg  [ 9:0] BltSRow;                        // Current source row
+reg  [ 9:0] BltRows;                        // Rows left
+reg  [11:0] BltLeft;                        // Bytes left in this row
+reg  [ 4:0] BltIdx;                         // Byte in the segment
+reg  [ 7:0] BltBuf [0:31];                  // Copy segment buffer
+reg  [ 8:0] ExpBase;                        // Bitmap address of the current row
+reg  [ 7:0] ExpQ;                           // Bitmap byte for the current column
+reg  [ 9:0] RleAddr;                        // Stream word being decoded
+reg  [16:0] RleLeft;                        // Bytes left in the packet, 0 = read a header
+reg         RleLit;                         // Literal packet, else run
+reg         RleOdd;                         // High byte of the word next
+reg  [15:0] RleColor;                       // Run color
+reg  [15:0] RleQ;                           // Stream word at RleAddr
+
+wire        BltReq  = (BltSync[1] != BltAck) & ~BltRun;                     // New command
+wire        BltWr   = BltFill | BltExp | BltRle | BltPhase;                 // Writing DRAM
+wire [11:0] BltSeg  = (BltLeft > 12'd32) ? 12'd32 : BltLeft;                // Segment length
+wire [11:0] BltOff  = BltRev ? (BltLeft - BltSeg) : (BltWidth - BltLeft);   // Segment start
+wire [10:0] BltCol  = (BltWr ? BltDstCol : BltSrcCol) + BltOff[10:0] + {6'd0, BltIdx};
+wire [11:0] ExpByte = BltOff + {7'd0, BltIdx};                             // Byte in the row
+wire [11:0] ExpPix  = Pal8 ? ExpByte : {1'b0, ExpByte[11:1]};               // Pixel in the row
+wire [11:0] ExpWide = Pal8 ? BltWidth : {1'b0, BltWidth[11:1]};             // Pixels per row
+wire [ 7:0] ExpPitch= (ExpWide + 12'd7) >> 3;                               // Bitmap bytes per row
+wire        ExpBit  = ExpQ[~ExpPix[2:0]];                                   // Pixel set
+wire [15:0] BltPen  = (BltFill | ExpBit) ? BltColor : ExpBg;                // Color for this pixel
+wire [15:0] RleWord = RleLit ? RleQ : RleColor;                            // Literal pixels or run
+wire [ 7:0] RleByte = (RleOdd & (RleLit | ~Pal8)) ? RleWord[15:8] : RleWord[7:0];
+wire [ 7:0] BltData = BltRle ? RleByte :
+                      (BltFill | BltExp) ? (BltCol[0] ? BltPen[15:8] : BltPen[7:0]) : BltBuf[BltIdx];
+wire        BltLast = ({7'd0, BltIdx} == BltSeg - 12'd1);                   // Last byte of segment
+
+always @(posedge clk) ExpQ <= ExpBuf[ExpBase + ExpPix[11:3]];               // Registered bitmap read
+always @(posedge clk) RleQ <= {RleBufH[RleAddr], RleBufL[RleAddr]};         // Registered stream read
 
 //-------------------------------------------------------------------------------------------------
 // Test Pattern
@@ -206,12 +1186,35 @@ assign lcd_b = {lcd_data[15:11], lcd_data[11]};   // Blue bits
 //-------------------------------------------------------------------------------------------------
 //    State Machine to Handle DRAM Access
 //-------------------------------------------------------------------------------------------------
-reg  [ 4:0] DRAMState;                      // State Machine Variable
-reg  [ 4:0] NextState;                      // Next machine state
-reg  [10:0] refcnt;                         // Referesh counter
+reg  [ 5:0] DRAMState;                      // State Machine Variable
+reg  [ 5:0] NextState;                      // Next machine state
+reg  [ 3:0] refcnt;                         // Referesh cycle step
+reg  [ 9:0] RefTimer;                       // One refresh owed per wrap
+reg  [ 6:0] RefOwed;                        // Refreshes owed
+reg         FetchMiss;                      // A line fetch missed its deadline, sticky
+reg  [ 1:0] MissSync;                       // MissClr into the DRAM clock
+reg         MissSeen;
+wire        RefEnd   = (DRAMState == 6'd31) && (refcnt == 4'h9);    // A refresh is done
+wire        RefDo    = (RefOwed != 7'd0) && (!VertData || RefOwed >= RefForce);
+wire        CpuIdle  = cache_empty & ~HoldPend & ~read_req & ~BltRun;  // Nothing for the CPU side
+reg  [ 4:0] BurstLeft;                      // Page mode writes left in this burst
+reg  [ 7:0] ReadBuf [0:31];                 // Read cache, one 32 byte row segment
+reg  [15:0] ReadTag;                        // {row, column / 32} of the segment
+reg         ReadValid;
+reg  [ 4:0] ReadIdx;                        // Byte being filled
+reg         Draining;                       // A FIFO entry is being written
+reg  [ 1:0] WrSync;                         // WrTgl into the DRAM clock
+reg  [ 1:0] WenSync;                        // Write strobe into the DRAM clock
+reg         WrLast;                         // WrSync a clock ago
+reg  [ 3:0] WrQuiet;                        // Clocks since the last CPU write or FIFO push
+wire [15:0] ReadAt   = {row_address[9:0], col_address[10:5]};  // Segment of the CPU read
+wire        ReadHit  = ReadValid & (ReadTag == ReadAt);
+wire        WrIdle   = (WrQuiet == 4'hF) & (WenSync == 2'b00);  // Writes are in the FIFO by now
+wire        ReadServe = read_req & ~read_rdy & ReadHit & WrIdle & ~HoldPend & cache_empty & ~Draining;
+reg  [11:0] BurstRow;                       // Row open for the burst
 //-------------------------------------------------------------------------------------------------
 always @(negedge clk) begin
-    if(reset) DRAMState <= 5'd00;           // Start with a zero count
+    if(reset) DRAMState <= 6'd00;           // Start with a zero count
     else      DRAMState <= NextState;
 end
 //-------------------------------------------------------------------------------------------------
@@ -223,9 +1226,28 @@ if(reset) begin                             // If reset line is low, then set in
     dram_RAS      <=  1'b1;                 // Put Ras in normal
     dram_Address  <= 12'd0;                 // Start at 0,0
     cache_req     <=  1'b0;                 // Cache read request clear
+    run_req       <=  1'b0;
     read_rdy      <=  1'b0;                 // Read ready clear
+    OvlPass       <=  2'd0;                 // Scanout fetch
+    OvlLast       <= 10'h3FF;               // No overlay line fetched
+    BltRun        <=  1'b0;                 // 2D engine idle
+    BltAck        <=  1'b0;
+    BltSync       <=  2'b00;
+    ReadValid     <=  1'b0;                 // Read cache empty
+    ScanLast      <= 10'h3FF;               // No line fetched
+    refcnt        <=  4'h0;                 // Refresh idle, nothing owed
+    RefTimer      <= 10'd0;
+    RefOwed       <=  7'd0;
+    FetchMiss     <=  1'b0;
+    MissSync      <=  2'b00;
+    MissSeen      <=  1'b0;
+    Draining      <=  1'b0;
+    WrQuiet       <=  4'd0;
+    WrSync        <=  2'b00;
+    WenSync       <=  2'b00;
 end
 else begin                                  // If reset line is high, then run the machines
+    run_req <= 1'b0;                        // One clock pulse, set by state 35
     case(DRAMState)                         // State Machine Case
         //-----------------------------------------------------------------------------------------
         // Load up FIFO buffers during horizontal blanking time: 
@@ -233,116 +1255,296 @@ else begin                                  // If reset line is high, then run t
         //  1 Line time = 800 XClk ticks @ 25mhz/2 => 0.08us x 800 = 64us
 		  //  1 Line time = 800 XClk ticks @ 25mhz/4 => 0.16us x 800 = 128us
 		  //  26us / .16us = 162.5 ~ 164 
+        // The line may be fetched anywhere between the end of the shown line and the deadline,
+        // the writer is four times faster than the scanout reading it. Until the deadline the
+        // fetch only starts when the CPU side has nothing to do, so drawing gets all the slack.
+        // FetchMargin covers the longest CPU turn (a drain burst plus a read fill or segment).
         //-----------------------------------------------------------------------------------------
-        5'd00: begin                                 // Initial State
-            if(DRAMReq) NextState <= 5'd01;          // Request to fill a buffer
-            else        NextState <= 5'd06;          // Step to next state on next clock cycle
+        6'd00: begin                                 // Initial State
+            OvlLine <= OvlT;                         // Overlay line for this fetch
+            OvlDue  <= OvlReq;
+            if(DRAMReq & (FetchDue | CpuIdle)) begin // Request to fill a buffer
+                ScanLast  <= CounterV;               // Fetch it once
+                if(OvlReq) OvlLast <= CounterV;
+                NextState <= 6'd01;
+            end
+            else if(OvlReq & (FetchDue | CpuIdle)) begin   // Overlay line only, e.g. in vertical blank
+                OvlLast   <= CounterV;
+                NextState <= 6'd10;
+            end
+            else            NextState <= 6'd06;      // Step to next state on next clock cycle
         end                                          // End State 
-        5'd01: begin                                 // Handle State 
-            dram_Address <= {2'b00,CounterV};        // Load our new line number into DRAM
-            NextState    <= 5'd02;                   // Step to next state on next clock cycle
+        6'd01: begin                                 // Handle State 
+            dram_Address <= {2'b00, (OvlPass != 2'd0) ? OvlFRow : Text ? TextRow : ScanRow};   // Load our new line number into DRAM
+            NextState    <= 6'd02;                   // Step to next state on next clock cycle
         end                                          // End State
-        5'd02: begin                                 // Handle State
+        6'd02: begin                                 // Handle State
             dram_RAS  <= 1'b0;                       // Pulse Row Address into DRAM
-            NextState <= 5'd03;                      // Step to next state on next clock cycle
+            NextState <= 6'd03;                      // Step to next state on next clock cycle
         end                                          // End State
-        5'd03: begin                                 // Handle State
-            dram_Address <= 12'd0;                   // Start at begining of the row
+        6'd03: begin                                 // Handle State
+            dram_Address <= {1'b0, OvlFCol};         // Start at begining of the row
             wr_addr      <= 10'b1;                   // Put the Horizontal address count into DRAM
-            wreq         <=  1'b1;                   // Request a write to the display pipeline
-            NextState    <= 5'd04;                   // Step to next state on next clock cycle
+            wreq         <= (OvlPass == 2'd0);       // Request a write to the display pipeline
+            NextState    <= 6'd04;                   // Step to next state on next clock cycle
         end                                          // End State
-        5'd04: begin                                 // Handle State
+        6'd04: begin                                 // Handle State
             dram_CAS  <= 1'b0;                       // Set CAS Low, DRAM data should be present on Data bus on next clk
-            NextState <= 5'd05;                      // Step to next state on next clock cycle
+            NextState <= 6'd05;                      // Step to next state on next clock cycle
         end                                          // End State
-        5'd05: begin                                 // Handle State
+        6'd05: begin                                 // Handle State
             dram_CAS <= 1'b1;                        // Set CAS Low, DRAM data should be present on Data bus on next clk
             wr_addr  <= wr_addr + 10'd1;             // Increment Horizontal Counter to next location
             dram_Address <= dram_Address + 12'd1;    // Increment Horizontal Counter to next location
-            if(CounterAmaxed) NextState <= 5'd06;    // Step to next state on next clock cycle
-            else              NextState <= 5'd04;    // Loop back to previous state on next clock cycle
+            OvlIdx   <= OvlIdx + 11'd1;              // Next overlay byte
+            if(OvlPass != 2'd0) begin                // Overlay pass
+                if(!OvlEnd)   NextState <= 6'd04;    // Loop back for the next byte
+                else if(OvlMore) NextState <= 6'd10; // Next planar pass
+                else begin
+                    OvlPass   <= 2'd0;               // Overlay line done
+                    NextState <= 6'd06;
+                end
+            end
+            else if(!CounterAmaxed) NextState <= 6'd04;  // Loop back to previous state on next clock cycle
+            else if(OvlDue)  NextState <= 6'd10;     // Fetch the overlay line as well
+            else             NextState <= 6'd06;     // Step to next state on next clock cycle
         end                                          // End State 
+        6'd10: begin                                 // Overlay pass, close the page first
+            wreq     <= 1'b0;                        // Exit DRAM FIFO mode
+            dram_RAS <= 1'b1;                        // DRAM Page mode by bringing RAS high
+            OvlIdx   <= 11'd0;                       // Start of the pass
+            OvlPass  <= OvlPass + 2'd1;              // Luma or packed line first
+            NextState <= 6'd01;                      // Load the row of the pass
+        end                                          // End State
 
         //-----------------------------------------------------------------------------------------
         // Handle any new data coming in from cache or read request
         //-----------------------------------------------------------------------------------------
-        5'd06: begin                                 // Handle State
+        6'd06: begin                                 // Handle State
             wreq <= 1'b0;                            // Exit DRAM FIFO mode
             dram_RAS <= 1'b1;                        // DRAM Page mode by bringing RAS high
-            if(cache_empty) NextState <= 5'd16;      // If cache is empty go check for a read or refresh
+            if(cache_empty) NextState <= 6'd16;      // If cache is empty go check for a read or refresh
 				else begin                               // Else something is in the cache
                 cache_req <= 1'b1;                   // Request a read from cache
-				    NextState <= 5'd07;                  // Go process next state
+                BurstLeft <= 5'd31;                  // Entries that may follow in page mode
+                Draining  <= 1'b1;
+				    NextState <= 6'd07;                  // Go process next state
             end                                      // end if
         end                                          // End State
-        5'd07: begin                                 // Handle State
+        6'd07: begin                                 // Handle State
             cache_req <= 1'b0;                       // Clear request a read from request
-            dram_Address <= cache_row;               // Load the previoulsy loaded user address
-            NextState <= 5'd08;                      // Step to next state on next clock cycle
+            NextState <= 6'd38;                      // The entry is out of the FIFO on this clock
         end                                          // End State
-        5'd08: begin                                 // Handle State
+        6'd38: begin                                 // Handle State
+            if(cache_run && run_empty) NextState <= 6'd38;   // Address not across yet
+            else begin
+                dram_Address <= cache_row;           // Load the previoulsy loaded user address
+                NextState <= 6'd08;                  // Step to next state on next clock cycle
+            end
+        end                                          // End State
+        6'd08: begin                                 // Handle State
 				dram_RAS <= 1'b0;                        // Return Ras to 1 to exit page mode
-            NextState <= 5'd09;                      // Step to next state on next clock cycle
+            NextState <= 6'd09;                      // Step to next state on next clock cycle
         end                                          // End State
-        5'd09: begin                                 // Handle State
+        6'd09: begin                                 // Handle State
             dram_Address <= cache_col;               // Start at front of buffer
+            BurstRow <= cache_row;                   // Row left open for the burst
             dram_WE  <= 1'b0;                        // Set RW mode
-            NextState <= 5'd11;                      // Step to next state on next clock cycle
+            NextState <= 6'd11;                      // Step to next state on next clock cycle
         end                                          // End State 
-        5'd11: begin                                 // Handle State 
+        6'd11: begin                                 // Handle State 
             dram_Data <= cache_data;                 // Load cached byte to DRAM 
             dram_CAS <= 1'b0;                        // Pulse Column Address into DRAM Column register
-            NextState <= 5'd12;                      // Step to next state on next clock cycle
+            if(ReadTag == {BurstRow[9:0], cache_col[10:5]}) ReadBuf[cache_col[4:0]] <= cache_data;  // Keep the read cache current
+            NextState <= 6'd12;                      // Step to next state on next clock cycle
         end                                          // End State 
-        5'd12: begin                                 // Handle State 
+        6'd12: begin                                 // Handle State 
             dram_CAS <= 1'b1;                        // Pulse Column Address into DRAM Column register
-            NextState <= 5'd13;                      // Step to next state on next clock cycle
+            if(cache_pair) NextState <= 6'd32;       // Second byte of the pair in page mode
+            else           NextState <= 6'd35;       // Try the next entry in the open row
+        end                                          // End State 
+        6'd32: begin                                 // Handle State 
+            dram_Address <= cache_col + 12'd1;       // Next column, same row
+            NextState <= 6'd33;                      // Step to next state on next clock cycle
+        end                                          // End State 
+        6'd33: begin                                 // Handle State 
+            dram_Data <= cache_hi;                   // Load the second byte to DRAM 
+            dram_CAS <= 1'b0;                        // Pulse Column Address into DRAM Column register
+            if(ReadTag == {BurstRow[9:0], dram_Address[10:5]}) ReadBuf[dram_Address[4:0]] <= cache_hi;
+            NextState <= 6'd34;                      // Step to next state on next clock cycle
+        end                                          // End State 
+        6'd34: begin                                 // Handle State 
+            dram_CAS <= 1'b1;                        // Pulse Column Address into DRAM Column register
+            NextState <= 6'd35;                      // Try the next entry in the open row
+        end                                          // End State 
+
+        //-----------------------------------------------------------------------------------------
+        // Page mode burst: keep RAS low and write the next FIFO entries while they hit the open
+        // row, until a line fetch reaches its deadline or 32 were written
+        //-----------------------------------------------------------------------------------------
+        6'd35: begin                                 // Handle State 
+            DrainAddr <= drain_a + (cache_pair ? 21'd2 : 21'd1);   // The next entry follows on from this one
+            run_req   <= cache_run;                  // Its run address is used up
+            if(!cache_empty && BurstLeft != 5'd0 && !FetchDue) begin
+                cache_req <= 1'b1;                   // Request a read from cache
+                BurstLeft <= BurstLeft - 5'd1;
+                NextState <= 6'd36;                  // Step to next state on next clock cycle
+            end
+            else NextState <= 6'd13;                 // Close the row
+        end                                          // End State 
+        6'd36: begin                                 // Handle State 
+            cache_req <= 1'b0;                       // Clear request a read from request
+            NextState <= 6'd37;                      // Step to next state on next clock cycle
         end                                          // End State 
-        5'd13: begin                                 // Handle State 
+        6'd37: begin                                 // Handle State 
+            if(cache_run && run_empty) NextState <= 6'd37;   // Address not across yet
+            else if(cache_row == BurstRow) begin     // Same row, column only
+                dram_Address <= cache_col;
+                NextState <= 6'd11;
+            end
+            else begin                               // Other row, close this one and open it
+                dram_RAS  <= 1'b1;                   // Precharge
+                dram_WE   <= 1'b1;
+                NextState <= 6'd07;
+            end
+        end                                          // End State 
+        6'd13: begin                                 // Handle State 
             dram_RAS <= 1'b1;                        // Return Ras to 1 to exit page mode
             dram_WE  <= 1'b1;                        // Always leave in read mode
-            NextState <= 5'd14;                      // Step to next state on next clock cycle
+            NextState <= 6'd14;                      // Step to next state on next clock cycle
         end                                          // End State 
-        5'd14: begin                                 // Handle State 
+        6'd14: begin                                 // Handle State 
             dram_Data <= 8'bZZZZZZZZ;                // If read mode, then Hi-Z The data bus to let DRAM output data
-            NextState <= 5'd31;                      // Step to next state on next clock cycle
+            Draining  <= 1'b0;                       // Read cache is current again
+            NextState <= 6'd31;                      // Step to next state on next clock cycle
         end                                          // End State 
 
         //-----------------------------------------------------------------------------------------
-        // Check for read request
+        // Check for read request. A miss fills the 32 byte row segment around the address into
+        // the read cache in page mode, the read and the ones after it are then served from there.
+        // Drain writes update the cached bytes, 2D engine writes drop the segment.
         //-----------------------------------------------------------------------------------------
-        5'd16: begin                                 // Handle State 
-            if(read_req) begin                       // Check to see if user read is pending
+        6'd16: begin                                 // Handle State 
+            if(HoldPend | ~WrIdle) NextState <= 6'd31;   // Writes go first, reads must see them
+            else if(read_req & ~ReadHit) begin       // Check to see if user read misses the read cache
                 dram_Address <= row_address;         // Load the previoulsy loaded user address
-				    NextState <= 5'd17;                  // If cache is empty go check for a read or refresh
+                ReadTag   <= ReadAt;                 // Fill the segment around it
+                ReadValid <= 1'b0;
+                ReadIdx   <= 5'd0;
+				    NextState <= 6'd17;                  // If cache is empty go check for a read or refresh
             end                                      // End if
-		      else NextState <= 5'd31;                 // Else something is in the cache
+            else if(BltRun) NextState <= 6'd22;      // Else give the gap to the 2D engine
+		      else NextState <= 6'd31;                 // Else something is in the cache
         end                                          // End State 
-        5'd17: begin                                 // Handle State
+        6'd17: begin                                 // Handle State
 				dram_RAS <= 1'b0;                        // Ras to 0 to clock in Row address
-            NextState <= 5'd18;                      // Step to next state on next clock cycle
+            NextState <= 6'd18;                      // Step to next state on next clock cycle
         end                                          // End State
-        5'd18: begin                                 // Handle State
-            dram_Address <= col_address;             // Load column address
-            NextState <= 5'd19;                      // Step to next state on next clock cycle
+        6'd18: begin                                 // Handle State
+            dram_Address <= {1'b0, ReadTag[5:0], ReadIdx};   // Load column address
+            NextState <= 6'd19;                      // Step to next state on next clock cycle
         end                                          // End State 
-        5'd19: begin                                 // Handle State 
+        6'd19: begin                                 // Handle State 
             dram_CAS <= 1'b0;                        // Pulse Column Address into DRAM Column register
-            NextState <= 5'd20;                      // Step to next state on next clock cycle
+            NextState <= 6'd20;                      // Step to next state on next clock cycle
         end                                          // End State 
-        5'd20: begin                                 // Handle State 
-            cpu_Data_o <= dram_Data;                 // Load cached byte to DRAM 
+        6'd20: begin                                 // Handle State 
+            ReadBuf[ReadIdx] <= dram_Data;           // Load the byte into the read cache
             dram_CAS <= 1'b1;                        // Pulse Column Address into DRAM Column register
-            NextState <= 5'd21;                      // Step to next state on next clock cycle
+            ReadIdx  <= ReadIdx + 5'd1;              // Next byte of the segment
+            if(ReadIdx == 5'd31) NextState <= 6'd21; // Segment done
+            else                 NextState <= 6'd18; // Loop back for the next byte in page mode
         end                                          // End State 
-        5'd21: begin                                 // Handle State 
+        6'd21: begin                                 // Handle State 
             dram_RAS <= 1'b1;                        // Return Ras to 1 to exit page mode
             dram_WE  <= 1'b1;                        // Always leave in read mode
-            read_rdy <= 1'b1;                        // Read ready clear
-            NextState <= 5'd31;                      // Step to next state on next clock cycle
+            ReadValid <= 1'b1;                       // The read is served from the cache
+            NextState <= 6'd31;                      // Step to next state on next clock cycle
         end                                          // End State 
 
+        //-----------------------------------------------------------------------------------------
+        // 2D engine, one page mode segment of up to 32 bytes per gap
+        //-----------------------------------------------------------------------------------------
+        6'd22: begin                                 // Handle State
+            dram_Address <= {2'b00, BltWr ? BltDRow : BltSRow};   // Row of this segment
+            BltIdx    <= 5'd0;                       // Start of the segment
+            NextState <= 6'd23;                      // Step to next state on next clock cycle
+        end                                          // End State
+        6'd23: begin                                 // Handle State
+            dram_RAS  <= 1'b0;                       // Ras to 0 to clock in Row address
+            if(BltRle && RleLeft == 17'd0) NextState <= 6'd28;   // Packet header first
+            else                           NextState <= 6'd24;   // Step to next state on next clock cycle
+        end                                          // End State
+        6'd24: begin                                 // Handle State
+            dram_Address <= {1'b0, BltCol};          // Load column address
+            if(BltWr) dram_WE <= 1'b0;               // Writing, set RW mode
+            NextState <= 6'd25;                      // Step to next state on next clock cycle
+        end                                          // End State
+        6'd25: begin                                 // Handle State
+            if(BltWr) dram_Data <= BltData;          // Writing, drive the data, ExpQ is ready now
+            if(BltWr) ReadValid <= 1'b0;             // The read cache may hold the old bytes
+            dram_CAS  <= 1'b0;                       // Pulse Column Address into DRAM Column register
+            NextState <= 6'd26;                      // Step to next state on next clock cycle
+        end                                          // End State
+        6'd26: begin                                 // Handle State
+            if(!BltWr) BltBuf[BltIdx] <= dram_Data;  // Reading, keep the byte
+            dram_CAS <= 1'b1;                        // Column done, stay in page mode
+            BltIdx   <= BltIdx + 5'd1;               // Next byte of the segment
+            if(BltRle) begin                         // Step through the packet
+                RleOdd  <= ~RleOdd;
+                RleLeft <= RleLeft - 17'd1;
+                if(RleLit & (RleOdd | (RleLeft == 17'd1))) RleAddr <= RleAddr + 10'd1;   // Word used up
+            end
+            if(BltLast) NextState <= 6'd27;          // Segment done
+            else if(BltRle && RleLeft == 17'd1) NextState <= 6'd28;   // Next packet header
+            else        NextState <= 6'd24;          // Loop back for the next byte
+        end                                          // End State
+        6'd27: begin                                 // Handle State
+            dram_RAS  <= 1'b1;                       // Return Ras to 1 to exit page mode
+            dram_WE   <= 1'b1;                       // Always leave in read mode
+            dram_Data <= 8'bZZZZZZZZ;                // Hi-Z The data bus
+            if(!BltWr) BltPhase <= 1'b1;             // Copy segment read, write it in the next gap
+            else begin
+                BltPhase <= 1'b0;
+                if(BltLeft != BltSeg) BltLeft <= BltLeft - BltSeg;         // Next segment
+                else begin                                                  // Next row
+                    BltLeft <= BltWidth;
+                    BltRows <= BltRows - 10'd1;
+                    ExpBase <= ExpBase + {1'b0, ExpPitch};
+                    BltDRow <= BltRev ? BltDRow - 10'd1 : BltDRow + 10'd1;
+                    BltSRow <= BltRev ? BltSRow - 10'd1 : BltSRow + 10'd1;
+                    if(BltRows == 10'd1) begin                              // Rectangle done
+                        BltRun <= 1'b0;
+                        BltAck <= BltSync[1];
+                    end
+                end
+            end
+            NextState <= 6'd31;                      // Step to next state on next clock cycle
+        end                                          // End State
+
+        //-----------------------------------------------------------------------------------------
+        // RLE packet header, read in page mode between the bytes of a segment
+        //-----------------------------------------------------------------------------------------
+        6'd28: begin                                 // Handle State
+            NextState <= 6'd29;                      // Wait for the stream read
+        end                                          // End State
+        6'd29: begin                                 // Handle State
+            RleLit    <= ~RleQ[15];                  // Take the header
+            RleLeft   <= Pal8 ? {2'b0, RleQ[14:0]} + 17'd1 : {1'b0, RleQ[14:0], 1'b0} + 17'd2;
+            RleOdd    <= 1'b0;
+            RleAddr   <= RleAddr + 10'd1;
+            if(RleQ[15]) NextState <= 6'd30;         // Run, read the color
+            else         NextState <= 6'd24;         // Literal, the pixels follow
+        end                                          // End State
+        6'd30: begin                                 // Handle State
+            NextState <= 6'd15;                      // Wait for the stream read
+        end                                          // End State
+        6'd15: begin                                 // Handle State
+            RleColor  <= RleQ;                       // Take the run color
+            RleAddr   <= RleAddr + 10'd1;
+            NextState <= 6'd24;                      // Write the run
+        end                                          // End State
+
         //-----------------------------------------------------------------------------------------
         //-----------------------------------------------------------------------------------------
         // Handle DRAM Refresh - need complete refresh every 64ms, burst every 15.6us
@@ -351,29 +1553,134 @@ else begin                                  // If reset line is high, then run t
         //    2^11  1500 / 100Mhz = 15.0  
          //   
          //   2^10 = 1024 /  100Mhz = 10us :  burst about every 10us or so
+        // RefTimer owes one CAS before RAS refresh every 10us. They are paid back to back in
+        // vertical blanking, in active video only once RefForce are owed (0.64ms late at most).
         //-----------------------------------------------------------------------------------------
-        5'd31: begin                                 // Handle Refresh State 
-            case(refcnt)                             // Refresh machine
-                11'h5: dram_CAS <= 1'b0;             // Pulse Column Address into DRAM Column register
-                11'h6: ;                             // NOP
-                11'h7: dram_RAS <= 1'b0;             // Return Ras to 1 to exit page mode
-                11'h8: ;                             // NOP
-                11'h9: ;                             // NOP
-                11'hA: dram_CAS <= 1'b1;             // Pulse Column Address into DRAM Column register
-                11'hB: ;                             // NOP
-                11'hC: dram_RAS <= 1'b1;             // Return Ras to 1 to exit page mode
-                default: NextState <= 5'd00;         // Step to next state on next clock cycle
-            endcase                                  // End case refresh
-            refcnt <= refcnt + 11'h1;                // Increment the refresh counter
+        6'd31: begin                                 // Handle Refresh State 
+            if(refcnt == 4'h0 && !RefDo) NextState <= 6'd00;   // Nothing owed now
+            else begin
+                case(refcnt)                         // Refresh machine
+                    4'h0: dram_CAS <= 1'b0;          // Pulse Column Address into DRAM Column register
+                    4'h1: ;                          // NOP
+                    4'h2: dram_RAS <= 1'b0;          // Return Ras to 1 to exit page mode
+                    4'h3: ;                          // NOP
+                    4'h4: ;                          // NOP
+                    4'h5: dram_CAS <= 1'b1;          // Pulse Column Address into DRAM Column register
+                    4'h6: ;                          // NOP
+                    4'h7: dram_RAS <= 1'b1;          // Return Ras to 1 to exit page mode
+                    default: ;                       // Precharge
+                endcase                              // End case refresh
+                refcnt    <= (refcnt == 4'h9) ? 4'h0 : refcnt + 4'h1;   // Step the refresh cycle
+                NextState <= 6'd31;                  // Next one right after while owed
+            end
         end                                          // End refresh state
         //-----------------------------------------------------------------------------------------
-        default: NextState <= 5'd00;                 // Default machine state, defensive move
+        default: NextState <= 6'd00;                 // Default machine state, defensive move
     endcase                                          // End of State Machine Case
 
     if(!read_req) read_rdy <=  1'b0;                  // Read ready clear
+
+    BltSync <= {BltSync[0], BltGo};                  // Pick up 2D engine commands
+    if(BltReq) begin                                 // Load up a new command
+        if(BltWidth == 12'd0 || BltHeight == 10'd0) BltAck <= BltSync[1];   // Nothing to do
+        else BltRun <= 1'b1;
+        BltPhase <= 1'b0;
+        BltDRow  <= BltDstRow;
+        BltSRow  <= BltSrcRow;
+        BltRows  <= BltHeight;
+        BltLeft  <= BltWidth;
+        ExpBase  <= 9'd0;
+        RleAddr  <= 10'd0;
+        RleLeft  <= 17'd0;
+    end
+
+    WrSync   <= {WrSync[0], WrTgl};
+    WenSync  <= {WenSync[0], cpu_Wen};
+    WrLast   <= WrSync[1];
+    RefTimer <= RefTimer + 10'd1;
+    if(RefTimer == 10'h3FF && !RefEnd) begin         // One more refresh owed
+        if(RefOwed != 7'h7F) RefOwed <= RefOwed + 7'd1;
+    end
+    else if(RefTimer != 10'h3FF && RefEnd) RefOwed <= RefOwed - 7'd1;
+    MissSync <= {MissSync[0], MissClr};
+    MissSeen <= MissSync[1];
+    if(DRAMReq && CounterH == FrameW-1)     FetchMiss <= 1'b1;   // Line ends before its fetch started
+    else if(MissSeen != MissSync[1])        FetchMiss <= 1'b0;   // Cleared by a STAT write
+    if(WrLast != WrSync[1] || cache_wr) WrQuiet <= 4'd0;     // A write ended or an entry went in
+    else if(WrQuiet != 4'hF) WrQuiet <= WrQuiet + 4'd1;
+    if(ReadServe) begin
+        cpu_Data_o <= ReadBuf[col_address[4:0]];     // Read cache hit, no DRAM cycle
+        read_rdy   <= 1'b1;
+    end
 	 
 end                                                  // End of Machine 
 
+//-------------------------------------------------------------------------------------------------
+// Performance counters, free running on the DRAM clock. Writing CTRL bit0 copies all of them
+// into the snapshot the CPU reads through SEL and VAL0-3, bit1 clears them. Both requests cross
+// from the register write clock as toggles, so the snapshot is ready a few clocks after the write.
+//-------------------------------------------------------------------------------------------------
+reg  [ 2:0] PrfSel;                         // Snapshot counter to read
+reg         PrfSnap;                        // Toggled by a snapshot request
+reg         PrfClr;                         // Toggled by a clear request
+reg  [ 2:0] PrfSnapSync;                    // PrfSnap into the DRAM clock, last stage for the edge
+reg  [ 2:0] PrfClrSync;
+reg  [ 1:0] PrfWait;                        // cpu_wait into the DRAM clock
+reg         PrfMiss;                        // Miss seen on the clock before
+reg  [31:0] PrfCnt [0:6];                   // Live counters
+reg  [31:0] PrfVal [0:6];                   // Snapshot
+wire [31:0] PrfQ      = (PrfSel > 3'd6) ? 32'd0 : PrfVal[PrfSel];
+wire        PrfMissNow = DRAMReq && (CounterH == FrameW-1);            // Same as the STAT miss bit
+wire        DramIdle  = (DRAMState == 6'd00) || (DRAMState == 6'd06) || (DRAMState == 6'd16) ||
+                        (DRAMState == 6'd31 && refcnt == 4'h0 && !RefDo);
+
+wire [ 7:0] prf_reg_q = (cpu_Address[3:0] == `PRF_REG_SEL)  ? {5'b0, PrfSel} :
+                        (cpu_Address[3:0] == `PRF_REG_VAL0) ? PrfQ[ 7: 0] :
+                        (cpu_Address[3:0] == `PRF_REG_VAL1) ? PrfQ[15: 8] :
+                        (cpu_Address[3:0] == `PRF_REG_VAL2) ? PrfQ[23:16] :
+                        (cpu_Address[3:0] == `PRF_REG_VAL3) ? PrfQ[31:24] : 8'h55;
+
+always @(posedge reg_wrclk or posedge reset) begin
+    if(reset) begin
+        PrfSel  <= 3'd0;
+        PrfSnap <= 1'b0;
+        PrfClr  <= 1'b0;
+    end
+    else if(prf_bank) begin
+        case(cpu_Address[3:0])
+            `PRF_REG_CTRL: begin
+                               if(cpu_Data_i[0]) PrfSnap <= ~PrfSnap;
+                               if(cpu_Data_i[1]) PrfClr  <= ~PrfClr;
+                           end
+            `PRF_REG_SEL:  PrfSel <= cpu_Data_i[2:0];
+            default: ;
+        endcase
+    end
+end
+
+integer PrfI;
+always @(posedge clk) begin                 // Counters, cleared by request, not by reset
+    PrfSnapSync <= {PrfSnapSync[1:0], PrfSnap};
+    PrfClrSync  <= {PrfClrSync[1:0], PrfClr};
+    PrfWait     <= {PrfWait[0], cpu_wait};
+    PrfMiss     <= PrfMissNow;
+    if(PrfSnapSync[2] != PrfSnapSync[1]) begin
+        for(PrfI = 0; PrfI < 7; PrfI = PrfI + 1) PrfVal[PrfI] <= PrfCnt[PrfI];
+    end
+    if(PrfClrSync[2] != PrfClrSync[1]) begin
+        for(PrfI = 0; PrfI < 7; PrfI = PrfI + 1) PrfCnt[PrfI] <= 32'd0;
+    end
+    else begin
+        if(WrLast != WrSync[1])    PrfCnt[`PRF_CNT_WRITE] <= PrfCnt[`PRF_CNT_WRITE] + 32'd1;
+        if(ReadServe)              PrfCnt[`PRF_CNT_READ]  <= PrfCnt[`PRF_CNT_READ]  + 32'd1;
+        if(PrfWait[1])             PrfCnt[`PRF_CNT_WAIT]  <= PrfCnt[`PRF_CNT_WAIT]  + 32'd1;
+        if({20'd0, cache_rddw} > PrfCnt[`PRF_CNT_PEAK]) PrfCnt[`PRF_CNT_PEAK] <= {20'd0, cache_rddw};
+        if(PrfMissNow & ~PrfMiss)  PrfCnt[`PRF_CNT_MISS]  <= PrfCnt[`PRF_CNT_MISS]  + 32'd1;
+        if(RefEnd)                 PrfCnt[`PRF_CNT_REFR]  <= PrfCnt[`PRF_CNT_REFR]  + 32'd1;
+        if(DramIdle)               PrfCnt[`PRF_CNT_IDLE]  <= PrfCnt[`PRF_CNT_IDLE]  + 32'd1;
+    end
+end
+
 //-------------------------------------------------------------------------------------------------
 endmodule 
 //-------------------------------------------------------------------------------------------------
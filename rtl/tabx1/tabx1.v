@@ -38,6 +38,7 @@ module tabx1 (
     output     [ 5:0] lcd_b,           // LCD Blue signals
     output            lcd_xclk,			// LCD Pixel Clock
 	 output            lcd_de,          // LCD Data enable line
+	 output            lcd_irq,         // LCD vertical blank interrupt to ARM GPIO
 	 
     input             I2S_TF,				// I2S Frame sync Input
     input             I2S_TK,				// I2S Sample rate clock input
@@ -79,14 +80,30 @@ module tabx1 (
 
   wire  [7:0] cpu_Data_i  = cpu_Data;	   								// Data from ARM CPU
   assign      cpu_Data    = rd_en1 ? cpu_Data_o : 8'bZZZZZZZZ;   	// Bi-Directional Data to ARM CPU
-  wire  [7:0] cpu_Data_o  = cpu_Address[20] ? dat_out : lcd_out;
+  wire  [7:0] cpu_Data_o  = reg_space ? dat_out : lcd_out;
   assign      cpu_wait    = ~lcd_hold;										// CPU wants negative logic
-  wire  [7:0] dat_out	  = mse_dat;										// Peripheral data output
+  wire  [7:0] dat_out	  = lcd_regs ? lcd_reg_out : mse_dat;		// Peripheral data output
 
-  wire        lcd_wren = ~cpu_Address[20] & wr_en1;		// Write enable for the LCD
-  wire        lcd_rden = ~cpu_Address[20] & rd_en1;		// Read enable for the LCD
+  //        TBX_BASE     0x301FD000     /* TABX1 registers Base               */
+  //        TBX_SIZE     0x00001000     /* TABX1 registers Size               */
+  `define LCD_REG_PAGE   13'h1FDF 	// LCD register page, banks are decoded in lcd1
+
+  //-----------------------------------------------------------------------------------------------
+  // Address map, the LCD DRAM takes the whole 2MB window except for the top 64K register space
+  //    0x30000000 - 0x301EFFFF  LCD frame buffer, 2048 byte DRAM rows
+  //    0x301F0000 - 0x301FFFFF  Register space, LCD registers at 0x301FDF00, PS2 and KBD above
+  //    0x301F0000 - 0x301F0FFF  LCD streaming port window, written through the LCD write cache
+  //-----------------------------------------------------------------------------------------------
+  wire        reg_space = (cpu_Address[20:16] == 5'h1F);		// Register space select
+  wire        lcd_regs  = (cpu_Address[20: 8] == `LCD_REG_PAGE);	// LCD register page select
+  wire        lcd_strm  = (cpu_Address[20:12] == 9'h1F0);		// LCD streaming port select
+  wire        lcd_wren  = (~reg_space | lcd_strm) & wr_en1;		// Write enable for the LCD
+  wire        lcd_rden  = ~reg_space & rd_en1;				// Read enable for the LCD
+  wire        lcd_rgwr  =  lcd_regs  & wr_en1;				// Write enable for the LCD registers
+  wire        lcd_rgrd  =  lcd_regs  & rd_en1;				// Read enable for the LCD registers
   wire        lcd_hold;												// LCD wait line
   wire  [7:0] lcd_out;												// LCD data output
+  wire  [7:0] lcd_reg_out;											// LCD register data output
 
 //-------------------------------------------------------------------------------------------------
 //-------------------------------------------------------------------------------------------------
@@ -100,11 +117,16 @@ lcd1 lcd_u1(
 
     .cpu_Data_i   (cpu_Data_i),       	// Bi-Directional Data to ARM CPU
     .cpu_Data_o   (lcd_out),         	// Bi-Directional Data to ARM CPU
-    .cpu_Address  (cpu_Address[19:0]), // Address input from ARM CPU
+    .cpu_Address  (cpu_Address),      	// Address input from ARM CPU
     .cpu_Ren      (lcd_rden),         	// Read data enable, positive logic
     .cpu_Wen      (lcd_wren),         	// Write data enable, positive logic
     .cpu_wait     (lcd_hold),       	// CPU wait output, negative logic
 
+    .reg_Wen      (lcd_rgwr),         	// Register write enable, positive logic
+    .reg_Ren      (lcd_rgrd),         	// Register read enable, positive logic
+    .reg_Data_o   (lcd_reg_out),      	// Register data to ARM CPU
+    .lcd_irq      (lcd_irq),          	// Vertical blank interrupt
+
     .dram_Data    (dram_Data),      	// Bi-Directional DRAM Data port to SRAM
     .dram_Address (dram_Address),   	// Address output for DRAM
     .dram_CAS     (dram_CAS),       	// DRAM Column Address Strobe
@@ -2,10 +2,11 @@
 // Simple Frame Buffer driver                                             sfb.c 
 // This is a simple frame buffer driver thatn can be used with an FPGA type
 // LCD controller where the display size and other variables are basically 
-// fixed, so no control registers are needed. 
+// fixed, so only a few control registers are needed. 
 // -----------------------------------------------------------------------------
 #include <linux/types.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/kernel.h>
 #include <linux/errno.h>
 #include <linux/string.h>
@@ -15,10 +16,13 @@
 #include <linux/vmalloc.h>
 #include <linux/delay.h>
 #include <linux/interrupt.h>
+#include <linux/debugfs.h>
 #include <asm/uaccess.h>
 #include <linux/fb.h>
 #include <linux/init.h>
 #include <linux/platform_device.h>
+#include <linux/gpio.h>
+#include <mach/gpio.h>
 
 #include "sfb.h"
 
@@ -30,6 +34,65 @@ static unsigned long videomemory     = SFB_VIDEOMEMSTART;
 static unsigned long videomemorysize = SFB_VIDEOMEMSIZE;
 static struct fb_info fb_info;
 static u32 pseudo_palette[16];
+static void __iomem *sfb_io;            // FPGA window, screen_base if no shadow
+
+#define SFB_REG(r)  (sfb_io + LCD_REG_BASE + (r))   // LCD control register
+#define CUR_REG(r)  (sfb_io + CUR_REG_BASE + (r))   // Cursor register
+#define BLT_REG(r)  (sfb_io + BLT_REG_BASE + (r))   // 2D engine register
+#define EXP_REG(r)  (sfb_io + EXP_REG_BASE + (r))   // Color expansion register
+#define TXT_REG(r)  (sfb_io + TXT_REG_BASE + (r))   // Text mode font register
+#define OVL_REG(r)  (sfb_io + OVL_REG_BASE + (r))   // YUV overlay register
+#define RLE_REG(r)  (sfb_io + RLE_REG_BASE + (r))   // RLE stream register
+#define STR_REG(r)  (sfb_io + STR_REG_BASE + (r))   // Streaming port register
+#define TIM_REG(r)  (sfb_io + TIM_REG_BASE + (r))   // Display timing register
+#define PRF_REG(r)  (sfb_io + PRF_REG_BASE + (r))   // Performance counter register
+
+static DECLARE_WAIT_QUEUE_HEAD(sfb_vbl_wait);   // Woken on every vertical blank
+static unsigned long sfb_vbl_count;             // Vertical blanks seen
+static unsigned long sfb_fetch_misses;          // Frames with a late scanout line fetch
+static struct dentry *sfb_debugfs;              // debugfs directory, NULL if none
+static DEFINE_MUTEX(sfb_perf_lock);             // Counter select and read back
+static int sfb_irq = -1;                        // Vertical blank IRQ, -1 if none
+static u8  sfb_ctrl;                            // Copy of the LCD control register
+
+static DECLARE_WAIT_QUEUE_HEAD(sfb_fence_wait); // Woken when a fence retires
+static atomic_t sfb_queued_seq = ATOMIC_INIT(0);// Last fence handed out
+static u32 sfb_done_seq;                        // Last fence drained to the FPGA
+
+// Module Parameters -----------------------------------------------------------
+static int shadow = 1;
+module_param(shadow, int, 0);
+MODULE_PARM_DESC(shadow, "Draw into a system RAM shadow flushed by deferred I/O (default 1)");
+static int async = 0;
+module_param(async, int, 0);
+MODULE_PARM_DESC(async, "Queue write() to a worker when there is no shadow (default 0)");
+static int blit = 1;
+module_param(blit, int, 0);
+MODULE_PARM_DESC(blit, "Use the FPGA 2D engine for fills and copies (default 1)");
+static int stream = 1;
+module_param(stream, int, 0);
+MODULE_PARM_DESC(stream, "Write long spans through the FPGA streaming port (default 1)");
+static int text = 0;
+module_param(text, int, 0);
+MODULE_PARM_DESC(text, "Run the console in FPGA text mode, 8x16 font only (default 0)");
+static int smc_cal = 1;
+module_param(smc_cal, int, 0);
+MODULE_PARM_DESC(smc_cal, "Calibrate the FPGA bus timing at load (default 1)");
+static int smc_nws = -1;
+module_param(smc_nws, int, 0);
+MODULE_PARM_DESC(smc_nws, "FPGA chip select wait states 0-127, -1 = calibrate (default -1)");
+static int smc_setup = -1;
+module_param(smc_setup, int, 0);
+MODULE_PARM_DESC(smc_setup, "FPGA read/write setup cycles 0-7, -1 = calibrate (default -1)");
+static int smc_hold = -1;
+module_param(smc_hold, int, 0);
+MODULE_PARM_DESC(smc_hold, "FPGA read/write hold cycles 0-7, -1 = calibrate (default -1)");
+static int sfb_tile_shape = -1;                 // Text cursor shape in the sprite, -1 if none
+
+static inline int sfb_text_mode(struct fb_info *info)
+{
+    return(text && (info->var.accel_flags & FB_ACCELF_TEXT));
+}
 
 #define SFB_MAX_PALLETE_REG 16
 
@@ -39,8 +102,8 @@ static u32 pseudo_palette[16];
 static struct fb_var_screeninfo sfb_var __initdata = {
     .xres           = SFB_MAX_X,        // Visual  resolution
     .yres           = SFB_MAX_Y,        // Visual  resolution
-    .xres_virtual   = SFB_MAX_X,        // Virtual resolution
-    .yres_virtual   = SFB_MAX_Y,        // Virtual resolution
+    .xres_virtual   = SFB_VIRT_X,       // Virtual resolution
+    .yres_virtual   = SFB_VIRT_Y,       // Virtual resolution, front and back buffer
     .xoffset        = 0,		// offset from virtual to visible 
     .yoffset        = 0,		// resolution			
     .bits_per_pixel = 16,
@@ -52,13 +115,28 @@ static struct fb_var_screeninfo sfb_var __initdata = {
     .activate       = FB_ACTIVATE_NOW,  // set values immediately (or vbl)
     .height         = LCD_HEIGHT,
     .width          = LCD_WIDTH,
-    .left_margin    = 0,
-    .right_margin   = 384,
-    .upper_margin   = 0,
-    .lower_margin   = 0,
+    .pixclock       = TIM_PIXCLOCK << 2,   // 15Hz, sfb_modes[2]
+    .left_margin    = 48,
+    .right_margin   = 16,
+    .upper_margin   = 33,
+    .lower_margin   = 10,
+    .hsync_len      = 96,
+    .vsync_len      = 2,
     .vmode          = FB_VMODE_NONINTERLACED,
 };
 
+// -----------------------------------------------------------------------------
+// Display modes. The panel is always LCD_WIDTH x LCD_HEIGHT with 800x525
+// totals, only the FPGA pixel clock divider changes. A slower refresh leaves
+// more DRAM time between line fetches for CPU writes.
+// -----------------------------------------------------------------------------
+static const struct fb_videomode sfb_modes[] = {
+    // name          refresh  xres       yres        pixclock           left right upper lower hsync vsync
+    { "640x480-60",  60, LCD_WIDTH, LCD_HEIGHT, TIM_PIXCLOCK,      48, 16, 33, 10, 96, 2, 0, FB_VMODE_NONINTERLACED },
+    { "640x480-30",  30, LCD_WIDTH, LCD_HEIGHT, TIM_PIXCLOCK << 1, 48, 16, 33, 10, 96, 2, 0, FB_VMODE_NONINTERLACED },
+    { "640x480-15",  15, LCD_WIDTH, LCD_HEIGHT, TIM_PIXCLOCK << 2, 48, 16, 33, 10, 96, 2, 0, FB_VMODE_NONINTERLACED },
+};
+
 // -----------------------------------------------------------------------------
 // Set up "fixed" screeninfo
 // -----------------------------------------------------------------------------
@@ -67,233 +145,1522 @@ static struct fb_fix_screeninfo sfb_fix __initdata = {
     .type        = FB_TYPE_PACKED_PIXELS,
     .visual      = FB_VISUAL_TRUECOLOR,
     .smem_start  = SFB_VIDEOMEMSTART, // Start of frame buffer mem, (physical address) 
-    .smem_len    = SFB_VIDEOMEMSIZE,  // Length of frame buffer mem
+    .smem_len    = SFB_FBMEMSIZE,     // Length of frame buffer mem
     .mmio_start  = SFB_VIDEOMEMSTART, // Start of Memory Mapped I/O, (physical address)
     .mmio_len    = SFB_VIDEOMEMSIZE,  // Length of Memory Mapped I/O
-    .line_length = LCD_WIDTH*2,
+    .line_length = SFB_LINE,
     .xpanstep    = 0,
-    .ypanstep    = 0,
-    .ywrapstep   = 0,
+    .ypanstep    = 1,
+    .ywrapstep   = 1,
     .accel       = FB_ACCEL_NONE,
 };
 
 // -----------------------------------------------------------------------------
-// Function prototypes 
+// Function prototypes 
+// -----------------------------------------------------------------------------
+int            sfb_init(void);
+int            sfb_setup(char *);
+static int     sfb_check_var(struct fb_var_screeninfo *var, struct fb_info *info);
+static int     sfb_set_par(struct fb_info *info);
+static ssize_t sfb_read(struct fb_info *info, char *buf, size_t count, loff_t * ppos);
+static ssize_t sfb_write(struct fb_info *info, const char *buf, size_t count, loff_t * ppos);
+static void    sfb_fillrect(struct fb_info *info, const struct fb_fillrect *rect);
+static void    sfb_copyarea(struct fb_info *info, const struct fb_copyarea *area);
+static void    sfb_imageblit(struct fb_info *info, const struct fb_image *image);
+static int     sfb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long arg);
+static int     sfb_setcolreg(unsigned regno, unsigned r, unsigned g, unsigned b, unsigned transp, struct fb_info *info);
+static int     sfb_blank(int blank_mode, struct fb_info *info);
+static int     sfb_pan_display(struct fb_var_screeninfo *var, struct fb_info *info);
+static int     sfb_cursor(struct fb_info *info, struct fb_cursor *cursor);
+static int     sfb_sync(struct fb_info *info);
+static void    sfb_drain(struct fb_info *info);
+static int     sfb_flush_pending(struct fb_info *info);
+static void    sfb_push_rect(struct fb_info *info, u32 x, u32 y, u32 w, u32 h);
+
+// -----------------------------------------------------------------------------
+// Define fb_ops structure that is registered with the kernel.
+// Note: The drawing functions follow the FPGA DRAM layout instead of using
+// the generic cfb_xxx routines, which assume a linear screen_base.
+// -----------------------------------------------------------------------------
+static struct fb_ops sfb_ops = {
+    .owner        = THIS_MODULE,
+
+    .fb_check_var = sfb_check_var,     // Check variables
+    .fb_set_par   = sfb_set_par,
+
+    .fb_fillrect  = sfb_fillrect,      // Fill a rectangle
+    .fb_copyarea  = sfb_copyarea,      // Copy area
+    .fb_imageblit = sfb_imageblit,     // Image blit
+
+    .fb_read      = sfb_read,          // Special read function
+    .fb_write     = sfb_write,         // Special read function
+    .fb_ioctl     = sfb_ioctl,         // Driver specific ioctls
+
+    .fb_setcolreg = sfb_setcolreg,     // Set color register
+    .fb_blank     = sfb_blank,         // Blank Display
+    .fb_pan_display = sfb_pan_display, // Flip the scanout base
+    .fb_cursor    = sfb_cursor,        // Hardware cursor sprite
+    .fb_sync      = sfb_sync,          // Wait for queued writes to drain
+};
+
+// -----------------------------------------------------------------------------
+// For now this is a stub. Later will need to put in code to toggle a
+// GPIO line tied to the LCD controller enable line.
+// -----------------------------------------------------------------------------
+#define GPIO_PIN        11                  // Set Pin Number here
+#define LCD_ENABLE_PIN (1 << GPIO_PIN)     // Compute bit mask
+static void lcd_enable(int enable)
+{
+    unsigned long *portptr;
+    portptr = ioremap(PIOB_BASE, 1024);    // Initialize AT91 GPIO REG
+    if(enable) portptr[PIO_SODR] = LCD_ENABLE_PIN;   // Set bit
+    else       portptr[PIO_CODR] = LCD_ENABLE_PIN;   // clear bit
+}
+
+// -----------------------------------------------------------------------------
+// sfb_blank - blanks the display.
+//      @blank_mode: the blank mode we want.
+//      @info: frame buffer structure that represents a single frame buffer
+//
+//  Blank the screen if blank_mode != 0, else unblank. Return 0 if
+//    blanking succeeded, != 0 if un-/blanking failed due to e.g. a
+//    video mode which doesn't support it. Implements VESA suspend
+//    and powerdown modes on hardware that supports disabling hsync/vsync:
+//    blank_mode == 2: suspend vsync
+//    blank_mode == 3: suspend hsync
+//    blank_mode == 4: powerdown
+//
+//  Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_blank(int blank_mode, struct fb_info *info)
+{
+    switch(blank_mode) {
+        case FB_BLANK_UNBLANK:
+        case FB_BLANK_NORMAL:
+            lcd_enable(1);
+            break;
+        case FB_BLANK_VSYNC_SUSPEND:
+        case FB_BLANK_HSYNC_SUSPEND:
+            lcd_enable(0);
+            break;
+        case FB_BLANK_POWERDOWN:
+            lcd_enable(0);
+            break;
+        default:
+            return(-EINVAL);
+    }
+    // let fbcon do a soft blank for us
+    return(blank_mode == FB_BLANK_NORMAL) ? 1 : 0;
+}
+
+// -----------------------------------------------------------------------------
+// sfb_pan_display - pans the display.
+//      @var: frame buffer variable screen structure
+//      @info: frame buffer structure that represents a single frame buffer
+//
+//  Points the FPGA scanout at row yoffset. The FPGA takes the new base at the
+//  start of the next frame, so flipping between the front and back buffer
+//  is a single register write and never tears. fbcon scrolls through here
+//  from the console path, which may be atomic, so the deferred worker is not
+//  waited for. If mmap stores are still behind, the rows of the new frame
+//  are written through from the shadow before the flip instead, which does
+//  not sleep. fbcon and write() drawing is written through as it goes and
+//  pans without any flush.
+//  The scanout wraps at yres_virtual, so with FB_VMODE_YWRAP any yoffset
+//  inside the buffer is fine, which lets fbcon scroll without copying.
+//
+//  Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_pan_display(struct fb_var_screeninfo *var, struct fb_info *info)
+{
+    if(var->xoffset) return(-EINVAL);
+    if(var->vmode & FB_VMODE_YWRAP) {
+        if(var->yoffset >= info->var.yres_virtual) return(-EINVAL);
+    }
+    else if(var->yoffset + info->var.yres > info->var.yres_virtual) return(-EINVAL);
+
+    if(sfb_text_mode(info)) return(0);                // Text mode scans out from TXT_ROW
+    if(sfb_flush_pending(info)) {                     // New frame may still be only in RAM
+        u32 n = min(info->var.yres, info->var.yres_virtual - var->yoffset);
+        sfb_push_rect(info, 0, var->yoffset, info->var.xres_virtual, n);
+        if(n < info->var.yres)                        // Frame wraps to the top
+            sfb_push_rect(info, 0, 0, info->var.xres_virtual, info->var.yres - n);
+    }
+    fb_writew(var->yoffset, SFB_REG(LCD_REG_SCAN));   // Low byte then high byte commits
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Vertical blank interrupt. The FPGA raises lcd_irq for the blanking interval
+// and the PIO interrupts on both edges, so only the rising edge is counted.
+// A line fetch that missed its deadline in the frame is counted and cleared.
+// -----------------------------------------------------------------------------
+static irqreturn_t sfb_vbl_irq(int irq, void *dev_id)
+{
+    if(gpio_get_value(LCD_IRQ_PIN)) {
+        sfb_vbl_count++;
+        if(fb_readb(SFB_REG(LCD_REG_STAT)) & LCD_STAT_MISS) {
+            fb_writeb(LCD_STAT_MISS, SFB_REG(LCD_REG_STAT));
+            sfb_fetch_misses++;
+            if(printk_ratelimit()) printk(KERN_WARNING "sfb: scanout line fetch missed its deadline\n");
+        }
+        wake_up_interruptible(&sfb_vbl_wait);
+    }
+    return(IRQ_HANDLED);
+}
+
+// -----------------------------------------------------------------------------
+// Sleep until the next vertical blank starts
+// Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_wait_for_vsync(struct fb_info *info)
+{
+    unsigned long count = sfb_vbl_count;
+    long ret;
+
+    if(sfb_irq < 0) return(-ENODEV);
+    ret = wait_event_interruptible_timeout(sfb_vbl_wait, count != sfb_vbl_count, HZ / 2);
+    if(ret < 0)  return(ret);
+    if(ret == 0) return(-ETIMEDOUT);
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Look up the pixel value for a color index the way cfb does
+// -----------------------------------------------------------------------------
+static inline u32 sfb_pixel(struct fb_info *info, u32 color)
+{
+    if(info->fix.visual == FB_VISUAL_TRUECOLOR) return(((u32 *)info->pseudo_palette)[color]);
+    return(color);
+}
+
+// -----------------------------------------------------------------------------
+// RGB565 as the FPGA drives it, red in the low bits, from 16 bit components
+// -----------------------------------------------------------------------------
+#define SFB_RGB565(r, g, b) (((r) >> 11) | (((g) >> 10) << 5) | (((b) >> 11) << 11))
+
+// -----------------------------------------------------------------------------
+// RGB565 for a color index, through the colormap in every visual. The truecolor
+// pseudo palette holds red in the high bits, the FPGA wants it in the low ones.
+// -----------------------------------------------------------------------------
+static inline u32 sfb_color565(struct fb_info *info, u32 color)
+{
+    if(color >= info->cmap.len) return(0);
+    return(SFB_RGB565(info->cmap.red[color], info->cmap.green[color], info->cmap.blue[color]));
+}
+
+// -----------------------------------------------------------------------------
+// Write a 16 bit FPGA register as two byte cycles, low byte first. The high
+// byte write is what makes the FPGA take the value.
+// -----------------------------------------------------------------------------
+static inline void sfb_reg_writew(u16 v, void __iomem *reg)
+{
+    fb_writeb(v & 0xFF, reg);
+    fb_writeb(v >> 8,   reg + 1);
+}
+
+// -----------------------------------------------------------------------------
+// FPGA 2D engine. Fills and screen to screen copies are handed to the FPGA,
+// which works through them between scanout fetches, so a clear or a window
+// move is a few register writes instead of the whole rectangle crossing the
+// bus. The engine runs on its own, so anything that touches pixels through
+// the bus waits for it first with sfb_blt_wait(). fbcon may draw from printk
+// in any context while an ioctl loads the engine, so every load and fire is
+// done under sfb_blt_lock with interrupts off. Big rectangles are fed to the
+// engine in bands of SFB_BLT_BAND bytes, so no wait for it is much over 1ms.
+// An engine still busy after that is stuck: the operation returns -EBUSY and
+// the caller draws in software, and the next operation tries the engine again.
+// -----------------------------------------------------------------------------
+#define SFB_BLT_BAND    16384                   // Bytes the engine writes per command, copies count twice
+
+static DEFINE_SPINLOCK(sfb_blt_lock);           // One engine load and fire at a time
+
+static int sfb_blt_wait(void)
+{
+    int i;
+
+    if(!blit) return(0);
+    for(i = 0; i < 1000; i++) {                 // One band takes well under 1ms
+        if(!(fb_readb(BLT_REG(BLT_REG_STAT)) & BLT_STAT_BUSY)) return(0);
+        udelay(1);
+    }
+    if(printk_ratelimit()) printk(KERN_WARNING "sfb: 2D engine busy, drawing in software\n");
+    return(-EBUSY);
+}
+
+// -----------------------------------------------------------------------------
+// Fill n bytes by h rows at DRAM column col, row row with a 16 bit value,
+// its low byte goes to even columns
+// -----------------------------------------------------------------------------
+static int sfb_blt_paint(u32 col, u32 row, u32 n, u32 h, u32 color)
+{
+    u32 band, k;
+    unsigned long flags;
+
+    if(!n) return(0);
+    band = max_t(u32, SFB_BLT_BAND / n, 1);
+    for(; h; h -= k, row += k) {
+        k = min(h, band);
+        spin_lock_irqsave(&sfb_blt_lock, flags);
+        if(sfb_blt_wait()) {
+            spin_unlock_irqrestore(&sfb_blt_lock, flags);
+            return(-EBUSY);
+        }
+        sfb_reg_writew(col, BLT_REG(BLT_REG_DCOL));
+        sfb_reg_writew(row & (LCD_ROWS - 1), BLT_REG(BLT_REG_DROW));
+        sfb_reg_writew(n, BLT_REG(BLT_REG_WIDTH));
+        sfb_reg_writew(k, BLT_REG(BLT_REG_HGT));
+        sfb_reg_writew(color, BLT_REG(BLT_REG_COLOR));
+        fb_writeb(BLT_CMD_FILL, BLT_REG(BLT_REG_CMD));
+        spin_unlock_irqrestore(&sfb_blt_lock, flags);
+    }
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Copy n bytes by h rows from DRAM column scol, row srow to dcol, drow. When
+// the destination is below or right of the source the engine walks backwards,
+// and the bands go bottom up, so overlaps come out right.
+// -----------------------------------------------------------------------------
+static int sfb_blt_move(u32 scol, u32 srow, u32 dcol, u32 drow, u32 n, u32 h)
+{
+    u32 band, k, off;
+    unsigned long flags;
+    u8 cmd = BLT_CMD_COPY;
+
+    if(!n) return(0);
+    band = max_t(u32, SFB_BLT_BAND / 2 / n, 1);
+    if(drow > srow || (drow == srow && dcol > scol)) cmd |= BLT_CMD_REV;
+    for(; h; h -= k) {
+        k   = min(h, band);
+        off = (cmd & BLT_CMD_REV) ? h - 1 : 0;  // Reverse bands name their last row
+        spin_lock_irqsave(&sfb_blt_lock, flags);
+        if(sfb_blt_wait()) {
+            spin_unlock_irqrestore(&sfb_blt_lock, flags);
+            return(-EBUSY);
+        }
+        sfb_reg_writew(dcol, BLT_REG(BLT_REG_DCOL));
+        sfb_reg_writew((drow + off) & (LCD_ROWS - 1), BLT_REG(BLT_REG_DROW));
+        sfb_reg_writew(scol, BLT_REG(BLT_REG_SCOL));
+        sfb_reg_writew((srow + off) & (LCD_ROWS - 1), BLT_REG(BLT_REG_SROW));
+        sfb_reg_writew(n, BLT_REG(BLT_REG_WIDTH));
+        sfb_reg_writew(k, BLT_REG(BLT_REG_HGT));
+        fb_writeb(cmd, BLT_REG(BLT_REG_CMD));
+        spin_unlock_irqrestore(&sfb_blt_lock, flags);
+        if(!(cmd & BLT_CMD_REV)) {              // Forward bands walk down
+            srow += k;
+            drow += k;
+        }
+    }
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Fill w x h pixels at x, y with color, an 8 bit index goes in both bytes
+// -----------------------------------------------------------------------------
+static inline int sfb_blt_fill(struct fb_info *info, u32 x, u32 y, u32 w, u32 h, u32 color)
+{
+    u32 bpp = info->var.bits_per_pixel >> 3;
+
+    return(sfb_blt_paint(x * bpp, y, w * bpp, h, color));
+}
+
+// -----------------------------------------------------------------------------
+// Copy w x h pixels from sx, sy to dx, dy
+// -----------------------------------------------------------------------------
+static inline int sfb_blt_copy(struct fb_info *info, u32 sx, u32 sy, u32 dx, u32 dy, u32 w, u32 h)
+{
+    u32 bpp = info->var.bits_per_pixel >> 3;
+
+    return(sfb_blt_move(sx * bpp, sy, dx * bpp, dy, w * bpp, h));
+}
+
+// -----------------------------------------------------------------------------
+// Expand a monochrome image into w x h pixels at its dx, dy. Only the bitmap
+// crosses the bus, a band of rows at a time through the FPGA bitmap buffer.
+// -----------------------------------------------------------------------------
+static int sfb_blt_expand(struct fb_info *info, const struct fb_image *image, u32 w, u32 h, u32 fg, u32 bg)
+{
+    u32 bpp = info->var.bits_per_pixel >> 3;
+    const u8 *src = (const u8 *)image->data;
+    u32 pitch = (image->width + 7) / 8;         // Source bitmap bytes per row
+    u32 bytes = (w + 7) / 8;                    // Bytes per row the FPGA needs
+    u32 band  = EXP_BUF_SIZE / bytes;           // Rows per buffer load
+    u32 y = image->dy, n, i, j;
+    unsigned long flags;
+
+    for(; h; h -= n, y += n) {
+        n = min(h, band);
+        spin_lock_irqsave(&sfb_blt_lock, flags);
+        if(sfb_blt_wait()) {                    // Buffer is free once the engine is idle
+            spin_unlock_irqrestore(&sfb_blt_lock, flags);
+            return(-EBUSY);
+        }
+        sfb_reg_writew(0, EXP_REG(EXP_REG_ADDR));
+        for(i = 0; i < n; i++, src += pitch)
+            for(j = 0; j < bytes; j++) fb_writeb(src[j], EXP_REG(EXP_REG_DATA));
+
+        sfb_reg_writew(bg, EXP_REG(EXP_REG_BG));
+        sfb_reg_writew(image->dx * bpp, BLT_REG(BLT_REG_DCOL));
+        sfb_reg_writew(y & (LCD_ROWS - 1), BLT_REG(BLT_REG_DROW));
+        sfb_reg_writew(w * bpp, BLT_REG(BLT_REG_WIDTH));
+        sfb_reg_writew(n, BLT_REG(BLT_REG_HGT));
+        sfb_reg_writew(fg, BLT_REG(BLT_REG_COLOR));
+        fb_writeb(BLT_CMD_EXPAND, BLT_REG(BLT_REG_CMD));
+        spin_unlock_irqrestore(&sfb_blt_lock, flags);
+    }
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// sfb_cursor - drives the FPGA cursor sprite.
+//      @info: frame buffer structure that represents a single frame buffer
+//      @cursor: cursor state, only the fields flagged in cursor->set changed
+//
+//  The image is turned into the sprite's 2 bit format the same way the
+//  soft cursor draws it: inside the image each pixel is color 2 (fg) or
+//  color 1 (bg), outside it the sprite is transparent. Moving the cursor
+//  is just a position register write. Cursors bigger than the sprite are
+//  refused, so fbcon falls back to the soft cursor.
+//
+//  Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_cursor(struct fb_info *info, struct fb_cursor *cursor)
+{
+    const u8 *data = (const u8 *)cursor->image.data;
+    const u8 *mask = (const u8 *)cursor->mask;
+    u8  img[CUR_SIZE * CUR_SIZE / 4];
+    u32 x, y, pitch, bit, on, sh;
+
+    if(cursor->image.width > CUR_SIZE || cursor->image.height > CUR_SIZE) return(-EINVAL);
+
+    if(cursor->set & FB_CUR_SETPOS) {           // Virtual screen to display position
+        sh = (sfb_ctrl & LCD_CTRL_SCALE2) ? 1 : 0;      // Screen pixels are doubled when scaled
+        y = cursor->image.dy + info->var.yres_virtual - info->var.yoffset;
+        if(y >= info->var.yres_virtual) y -= info->var.yres_virtual;
+        sfb_reg_writew((cursor->image.dx - info->var.xoffset) << sh, CUR_REG(CUR_REG_X));
+        sfb_reg_writew(y << sh, CUR_REG(CUR_REG_Y));
+    }
+    if(cursor->set & FB_CUR_SETHOT) {
+        fb_writeb(cursor->hot.x, CUR_REG(CUR_REG_HOTX));
+        fb_writeb(cursor->hot.y, CUR_REG(CUR_REG_HOTY));
+    }
+    if(cursor->set & FB_CUR_SETCMAP) {
+        sfb_reg_writew(sfb_color565(info, cursor->image.bg_color), CUR_REG(CUR_REG_COL1));
+        sfb_reg_writew(sfb_color565(info, cursor->image.fg_color), CUR_REG(CUR_REG_COL2));
+    }
+    if((cursor->set & (FB_CUR_SETSIZE | FB_CUR_SETSHAPE | FB_CUR_SETIMAGE)) && data && mask) {
+        memset(img, 0, sizeof(img));
+        pitch = (cursor->image.width + 7) / 8;
+        for(y = 0; y < cursor->image.height; y++) {
+            for(x = 0; x < cursor->image.width; x++) {
+                bit = 0x80 >> (x & 7);
+                if(cursor->rop == ROP_XOR) on = !(data[x / 8] & bit) != !(mask[x / 8] & bit);
+                else                       on =  (data[x / 8] & bit) &&  (mask[x / 8] & bit);
+                img[y * (CUR_SIZE / 4) + x / 4] |= (on ? CUR_FG : CUR_BG) << ((x & 3) * 2);
+            }
+            data += pitch;
+            mask += pitch;
+        }
+        fb_writeb(0, CUR_REG(CUR_REG_ADDR));
+        for(x = 0; x < sizeof(img); x++) fb_writeb(img[x], CUR_REG(CUR_REG_DATA));
+        sfb_tile_shape = -1;
+    }
+    fb_writeb(cursor->enable ? CUR_CTRL_EN : 0, CUR_REG(CUR_REG_CTRL));
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// sfb_setcolreg - sets a color register.
+//     regno:  Which register in the CLUT we are programming
+//     red:    The red value which can be up to 16 bits wide
+//     green:  The green value which can be up to 16 bits wide
+//     blue:   The blue value which can be up to 16 bits wide.
+//     transp: If supported the alpha value which can be up to 16 bits wide.
+//     info:   frame buffer info structure
+//
+// Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_setcolreg(unsigned regno, unsigned r, unsigned g,unsigned b, unsigned transp, struct fb_info *info)
+{
+    if(info->fix.visual == FB_VISUAL_PSEUDOCOLOR) {     // FPGA CLUT entry
+        if(regno >= 256) return(1);
+        fb_writeb(regno, SFB_REG(LCD_REG_CLUTA));
+        sfb_reg_writew(SFB_RGB565(r, g, b), SFB_REG(LCD_REG_CLUT));
+        return(0);
+    }
+    if(regno >= SFB_MAX_PALLETE_REG) return(1); //no. of hw registers
+    if(sfb_text_mode(info)) {                           // Text mode colors come from the CLUT
+        fb_writeb(regno, SFB_REG(LCD_REG_CLUTA));
+        sfb_reg_writew(SFB_RGB565(r, g, b), SFB_REG(LCD_REG_CLUT));
+    }
+
+//  ((u32 *) info->pseudo_palette)[regno]  = (r  << info->var.red.offset) | (g      << info->var.green.offset) |
+//                                           (b << info->var.blue.offset) | (transp << info->var.transp.offset);
+
+    ((u32 *) info->pseudo_palette)[regno] = (r & 0xf800) | (g & 0xfc00) >> 5 | (b & 0xf800) >> 11;
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// By reading and writing along the video DRAM row and column boundaries
+// it speeds up the graphics by 50%. Each logical line of SFB_LINE bytes
+// starts on its own LCD_PITCH byte DRAM row.
+// -----------------------------------------------------------------------------
+#define SFB_ROW(r)         ((((unsigned long)(r))&(LCD_ROWS-1))*LCD_PITCH) // DRAM row offset
+#define SFB_BOUNCE_SIZE    PAGE_SIZE                               // User copy chunk size
+
+// -----------------------------------------------------------------------------
+// Copy a run of bytes that lies within one DRAM row out to the FPGA. The
+// SMC splits each 32 bit store into byte cycles on the 8 bit bus by itself,
+// so the CPU only issues one store for every 4 bytes. The caller must keep
+// src and dst co-aligned (same address modulo 4).
+// -----------------------------------------------------------------------------
+static inline void sfb_write_run(void __iomem *dst, const u8 *src, unsigned long n)
+{
+    while(n && ((unsigned long)dst & 3)) {      // Align head to 32 bits
+        fb_writeb(*src++, dst++);
+        n--;
+    }
+    while(n >= 16) {                            // Unrolled word copy
+        fb_writel(((const u32 *)src)[0], dst     );
+        fb_writel(((const u32 *)src)[1], dst +  4);
+        fb_writel(((const u32 *)src)[2], dst +  8);
+        fb_writel(((const u32 *)src)[3], dst + 12);
+        src += 16, dst += 16;
+        n   -= 16;
+    }
+    while(n >= 4) {
+        fb_writel(*(const u32 *)src, dst);
+        src += 4, dst += 4;
+        n   -= 4;
+    }
+    while(n--) fb_writeb(*src++, dst++);        // Tail bytes
+}
+
+// -----------------------------------------------------------------------------
+// Same as above in the other direction, FPGA row to kernel buffer
+// -----------------------------------------------------------------------------
+static inline void sfb_read_run(u8 *dst, const void __iomem *src, unsigned long n)
+{
+    while(n && ((unsigned long)src & 3)) {      // Align head to 32 bits
+        *dst++ = fb_readb(src++);
+        n--;
+    }
+    while(n >= 4) {
+        *(u32 *)dst = fb_readl(src);
+        src += 4, dst += 4;
+        n   -= 4;
+    }
+    while(n--) *dst++ = fb_readb(src++);        // Tail bytes
+}
+
+// -----------------------------------------------------------------------------
+// Streaming port. The FPGA keeps the DRAM address of the next byte and steps
+// it along the rows between the left and right columns, so a long span is
+// just stores into the window, with no address handling in the copy loop.
+// One user at a time, the others write the rows directly.
+// -----------------------------------------------------------------------------
+#define SFB_STREAM_MIN  256                     // Shorter spans are not worth the setup
+
+static DEFINE_MUTEX(sfb_stream_lock);
+
+static void sfb_stream_start(unsigned long addr, u32 left, u32 right)
+{
+    sfb_reg_writew(left,  STR_REG(STR_REG_LEFT));
+    sfb_reg_writew(right, STR_REG(STR_REG_RIGHT));
+    sfb_reg_writew(addr,  STR_REG(STR_REG_PTR));
+    fb_writeb(addr >> 16, STR_REG(STR_REG_PTR + 2));   // Commits, restarts the stream
+}
+
+static void sfb_stream_write(const u8 *src, unsigned long n)
+{
+    unsigned long run;
+
+    while(n) {                                  // Co-aligned bursts within the window
+        run = min_t(unsigned long, n, STR_WIN_SIZE - 4);
+        sfb_write_run(sfb_io + STR_WIN_BASE + ((unsigned long)src & 3), src, run);
+        src += run;
+        n   -= run;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Write n bytes from src to the frame buffer at logical offset p. The span is
+// split into runs that do not cross a logical line, so the address is
+// translated once per run instead of once per pixel. Long spans go through the
+// streaming port, which wraps at the end of each logical line by itself.
+// -----------------------------------------------------------------------------
+static void sfb_write_span(void __iomem *base, unsigned long p, const u8 *src, unsigned long n)
+{
+    unsigned long row, col, run;
+
+    sfb_blt_wait();
+    if(stream && base == sfb_io && n >= SFB_STREAM_MIN && mutex_trylock(&sfb_stream_lock)) {
+        sfb_stream_start(SFB_ROW(p / SFB_LINE) + p % SFB_LINE, 0, SFB_LINE % LCD_PITCH);
+        sfb_stream_write(src, n);
+        mutex_unlock(&sfb_stream_lock);
+        return;
+    }
+    row = p / SFB_LINE;                         // Translate once, then walk rows
+    col = p % SFB_LINE;
+    while(n) {
+        run = min_t(unsigned long, n, SFB_LINE - col);
+        sfb_write_run(base + SFB_ROW(row) + col, src, run);
+        src += run;
+        n   -= run;
+        col  = 0;
+        row++;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Read n bytes from the frame buffer at logical offset p into dst
+// -----------------------------------------------------------------------------
+static void sfb_read_span(u8 *dst, const void __iomem *base, unsigned long p, unsigned long n)
+{
+    unsigned long row, col, run;
+
+    sfb_blt_wait();
+    row = p / SFB_LINE;                         // Translate once, then walk rows
+    col = p % SFB_LINE;
+    while(n) {
+        run = min_t(unsigned long, n, SFB_LINE - col);
+        sfb_read_run(dst, base + SFB_ROW(row) + col, run);
+        dst += run;
+        n   -= run;
+        col  = 0;
+        row++;
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Copy user data to the frame buffer at logical offset p. The data is pulled
+// into a bounce buffer a page at a time and written out in row runs.
+// Returns the number of bytes not copied.
+// -----------------------------------------------------------------------------
+static unsigned long sfb_copy_from_user(void __iomem *base, unsigned long p, const char __user *buf, unsigned long n)
+{
+    unsigned long chunk;
+    u8 *bounce, *src;
+
+    bounce = kmalloc(SFB_BOUNCE_SIZE + 4, GFP_KERNEL);
+    if(!bounce) return(n);
+
+    src = bounce + (p & 3);                     // Keep co-aligned with the FPGA address
+    while(n) {
+        chunk = min_t(unsigned long, n, SFB_BOUNCE_SIZE);
+        if(copy_from_user(src, buf, chunk)) break;
+        sfb_write_span(base, p, src, chunk);
+        buf += chunk;
+        p   += chunk;
+        n   -= chunk;
+    }
+    kfree(bounce);
+    return(n);
+}
+
+// -----------------------------------------------------------------------------
+// Copy frame buffer data at logical offset p to the user, row runs at a time
+// Returns the number of bytes not copied.
+// -----------------------------------------------------------------------------
+static unsigned long sfb_copy_to_user(void __iomem *base, unsigned long p, char __user *buf, unsigned long n)
+{
+    unsigned long chunk;
+    u8 *bounce, *dst;
+
+    bounce = kmalloc(SFB_BOUNCE_SIZE + 4, GFP_KERNEL);
+    if(!bounce) return(n);
+
+    dst = bounce + (p & 3);                     // Keep co-aligned with the FPGA address
+    while(n) {
+        chunk = min_t(unsigned long, n, SFB_BOUNCE_SIZE);
+        sfb_read_span(dst, base, p, chunk);
+        if(copy_to_user(buf, dst, chunk)) break;
+        buf += chunk;
+        p   += chunk;
+        n   -= chunk;
+    }
+    kfree(bounce);
+    return(n);
+}
+
+// -----------------------------------------------------------------------------
+// Shadow frame buffer. With shadow=1 the frame buffer lives in system RAM,
+// user space mmaps that and fb_deferred_io tracks the pages it touches. The
+// deferred worker then flushes only the dirty pages out to the FPGA in row
+// runs. write() and the drawing functions write through as they go, so only
+// mmap stores wait for the worker. Reads are served from RAM instead of the
+// slow FPGA read path.
+//
+// Whether the FPGA is behind the shadow is kept as two generations: the first
+// mmap store after a flush bumps sfb_dirty_gen, and the worker stores the
+// generation its page list covered in sfb_clean_gen once the pages are out.
+// first_io and the worker both run under the deferred I/O lock, so a store
+// the worker did not see always shows up as a newer generation.
+// -----------------------------------------------------------------------------
+static void sfb_deferred_io(struct fb_info *info, struct list_head *pagelist);
+static void sfb_first_io(struct fb_info *info);
+
+// -----------------------------------------------------------------------------
+// Mark every fence up to seq as drained to the FPGA
+// -----------------------------------------------------------------------------
+static inline void sfb_retire(u32 seq)
+{
+    sfb_done_seq = seq;
+    wake_up_interruptible(&sfb_fence_wait);
+}
+
+static struct fb_deferred_io sfb_defio = {
+    .delay       = HZ / 20,                    // Flush at most every 50ms
+    .first_io    = sfb_first_io,
+    .deferred_io = sfb_deferred_io,
+};
+
+static DEFINE_MUTEX(sfb_flush_lock);            // write() and the worker, one flush at a time
+static atomic_t sfb_dirty_gen = ATOMIC_INIT(0); // Bumped by the first mmap store after a flush
+static atomic_t sfb_clean_gen = ATOMIC_INIT(0); // Generation the worker last flushed
+
+// -----------------------------------------------------------------------------
+// Flush n bytes of the shadow at logical offset p out to the FPGA
+// -----------------------------------------------------------------------------
+static inline void sfb_flush(struct fb_info *info, unsigned long p, unsigned long n)
+{
+    if(p >= info->fix.smem_len) return;
+    if(n > info->fix.smem_len - p) n = info->fix.smem_len - p;
+    sfb_write_span(sfb_io, p, (u8 *)info->screen_base + p, n);
+}
+
+// -----------------------------------------------------------------------------
+// Non-zero while mmap stores may not have reached the FPGA yet, safe from any
+// context
+// -----------------------------------------------------------------------------
+static int sfb_flush_pending(struct fb_info *info)
+{
+    if(!shadow) return(0);
+    smp_rmb();
+    return(atomic_read(&sfb_dirty_gen) != atomic_read(&sfb_clean_gen));
+}
+
+static void sfb_first_io(struct fb_info *info)
+{
+    atomic_inc(&sfb_dirty_gen);
+    smp_wmb();
+}
+
+// -----------------------------------------------------------------------------
+// Deferred I/O worker callback. The page list is sorted, so neighbouring
+// dirty pages are merged into one span before flushing.
+// -----------------------------------------------------------------------------
+static void sfb_deferred_io(struct fb_info *info, struct list_head *pagelist)
+{
+    unsigned long start, end;
+    struct page *page;
+    u32 seq = atomic_read(&sfb_queued_seq);     // Fences handed out so far are covered
+    int gen = atomic_read(&sfb_dirty_gen);      // Stores in this page list
+
+    mutex_lock(&sfb_flush_lock);
+    start = end = 0;
+    list_for_each_entry(page, pagelist, lru) {  // Pages written through mmap
+        unsigned long p = page->index << PAGE_SHIFT;
+        if(p != end) {
+            sfb_flush(info, start, end - start);
+            start = p;
+        }
+        end = p + PAGE_SIZE;
+    }
+    sfb_flush(info, start, end - start);
+    mutex_unlock(&sfb_flush_lock);
+
+    smp_wmb();                                  // Pages out before the generation
+    atomic_set(&sfb_clean_gen, gen);
+    sfb_retire(seq);
+}
+
+// -----------------------------------------------------------------------------
+// Asynchronous writes. With async=1 and no shadow, write() copies the data
+// into a request and returns, a single threaded worker then drains the
+// requests to the FPGA in order, so the caller can render the next frame
+// while the bus is still busy with this one. Each request carries a fence
+// sequence number, which the worker retires once the data is on the bus.
+// The queue is bounded so a fast writer blocks instead of eating memory.
+// -----------------------------------------------------------------------------
+#define SFB_REQ_SIZE    (16 * PAGE_SIZE)        // Largest single request
+#define SFB_QUEUE_SIZE  (SFB_FBMEMSIZE / 2)     // Bytes allowed in the queue
+
+struct sfb_req {
+    struct list_head list;                      // Queue link
+    unsigned long    p;                         // Logical frame buffer offset
+    unsigned long    n;                         // Byte count
+    u32              seq;                       // Fence retired by this request
+    u8               data[0];                   // Data starts at data + (p & 3)
+};
+
+static void sfb_async_work(struct work_struct *work);
+
+static struct workqueue_struct *sfb_wq;         // Async worker, NULL if not used
+static DECLARE_WORK(sfb_work, sfb_async_work);
+static DEFINE_SPINLOCK(sfb_queue_lock);         // Protects the queue
+static LIST_HEAD(sfb_queue);                    // Pending requests, oldest first
+static unsigned long sfb_queue_bytes;           // Bytes in the queue
+static DECLARE_WAIT_QUEUE_HEAD(sfb_space_wait); // Woken when the queue shrinks
+
+// -----------------------------------------------------------------------------
+// Worker, drains the queue to the FPGA and retires the fences
+// -----------------------------------------------------------------------------
+static void sfb_async_work(struct work_struct *work)
+{
+    struct sfb_req *req;
+    unsigned long flags;
+
+    for(;;) {
+        spin_lock_irqsave(&sfb_queue_lock, flags);
+        if(list_empty(&sfb_queue)) {
+            spin_unlock_irqrestore(&sfb_queue_lock, flags);
+            break;
+        }
+        req = list_first_entry(&sfb_queue, struct sfb_req, list);
+        list_del(&req->list);
+        spin_unlock_irqrestore(&sfb_queue_lock, flags);
+
+        sfb_write_span(sfb_io, req->p, req->data + (req->p & 3), req->n);
+
+        spin_lock_irqsave(&sfb_queue_lock, flags);
+        sfb_queue_bytes -= req->n;
+        spin_unlock_irqrestore(&sfb_queue_lock, flags);
+        wake_up_interruptible(&sfb_space_wait);
+        sfb_retire(req->seq);
+        kfree(req);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Queue user data for the FPGA at logical offset p
+// Returns the number of bytes not queued.
+// -----------------------------------------------------------------------------
+static unsigned long sfb_queue_from_user(unsigned long p, const char __user *buf, unsigned long n)
+{
+    struct sfb_req *req;
+    unsigned long chunk, flags;
+
+    while(n) {
+        chunk = min_t(unsigned long, n, SFB_REQ_SIZE);
+        if(wait_event_interruptible(sfb_space_wait, sfb_queue_bytes + chunk <= SFB_QUEUE_SIZE)) break;
+
+        req = kmalloc(sizeof(*req) + chunk + 4, GFP_KERNEL);
+        if(!req) break;
+        if(copy_from_user(req->data + (p & 3), buf, chunk)) {
+            kfree(req);
+            break;
+        }
+        req->p = p;
+        req->n = chunk;
+
+        spin_lock_irqsave(&sfb_queue_lock, flags);  // Fence order matches queue order
+        req->seq = atomic_inc_return(&sfb_queued_seq);
+        list_add_tail(&req->list, &sfb_queue);
+        sfb_queue_bytes += chunk;
+        spin_unlock_irqrestore(&sfb_queue_lock, flags);
+        queue_work(sfb_wq, &sfb_work);
+
+        buf += chunk;
+        p   += chunk;
+        n   -= chunk;
+    }
+    return(n);
+}
+
+// -----------------------------------------------------------------------------
+// Push everything written so far out to the FPGA, used before anything that
+// depends on the frame buffer contents being current. Waits for the deferred
+// and async workers, so only from process context, never from the fbcon or
+// pan_display paths.
+// -----------------------------------------------------------------------------
+static void sfb_drain(struct fb_info *info)
+{
+    might_sleep();
+    if(shadow) flush_delayed_work(&info->deferred_work);
+    if(sfb_wq) flush_workqueue(sfb_wq);
+}
+
+// -----------------------------------------------------------------------------
+// Poll until the FPGA write cache FIFO is empty. The FIFO is at most 4K
+// entries, which the DRAM state machine drains in well under a millisecond.
+// Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_wait_idle(void)
+{
+    int i;
+
+    for(i = 0; i < 1000; i++) {
+        if(fb_readb(SFB_REG(LCD_REG_STAT)) & LCD_STAT_IDLE) return(0);
+        udelay(1);
+    }
+    return(-ETIMEDOUT);
+}
+
+// -----------------------------------------------------------------------------
+// sfb_sync - wait until every pending write has landed in video DRAM
+// -----------------------------------------------------------------------------
+static int sfb_sync(struct fb_info *info)
+{
+    sfb_drain(info);
+    sfb_blt_wait();
+    return(sfb_wait_idle());
+}
+
+// -----------------------------------------------------------------------------
+// SFBIO_FENCE - hand out a fence covering every write made so far. With a
+// shadow, mmap stores are not seen by the driver, so a new fence is made and
+// the deferred worker retires it on its next pass.
+// -----------------------------------------------------------------------------
+static u32 sfb_fence(struct fb_info *info)
+{
+    u32 seq;
+
+    if(!shadow) return(atomic_read(&sfb_queued_seq));
+    seq = atomic_inc_return(&sfb_queued_seq);
+    schedule_delayed_work(&info->deferred_work, sfb_defio.delay);
+    return(seq);
+}
+
+// -----------------------------------------------------------------------------
+// SFBIO_WAIT - sleep until fence seq has retired and the FPGA FIFO is empty
+// Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_wait_fence(u32 seq)
+{
+    int ret;
+
+    ret = wait_event_interruptible(sfb_fence_wait, (s32)(sfb_done_seq - seq) >= 0);
+    if(ret) return(ret);
+    return(sfb_wait_idle());
+}
+
+// -----------------------------------------------------------------------------
+// Drawing functions. These know the FPGA DRAM layout: each rectangle row is
+// one contiguous run at SFB_ROW(y) + x, so the address math is done once per
+// row and only the bytes inside the rectangle cross the bus.
+//
+// With a shadow, the generic sys_xxx helpers draw into RAM and the touched
+// rectangle is then written through to the FPGA from the shadow, so the
+// FPGA is never read back. Without one, rows are built and written directly.
+// The line buffer is only used without a shadow; calls are serialised by
+// the console lock or the fb_info lock.
+// -----------------------------------------------------------------------------
+static u32 sfb_linebuf[LCD_PITCH / 4];          // One DRAM row of pixels
+
+// -----------------------------------------------------------------------------
+// Clip a rectangle to the virtual screen, returns 0 if nothing is left
+// -----------------------------------------------------------------------------
+static inline int sfb_clip(struct fb_info *info, u32 x, u32 y, u32 *w, u32 *h)
+{
+    if(x >= info->var.xres_virtual || y >= info->var.yres_virtual) return(0);
+    if(*w > info->var.xres_virtual - x) *w = info->var.xres_virtual - x;
+    if(*h > info->var.yres_virtual - y) *h = info->var.yres_virtual - y;
+    return(*w && *h);
+}
+
+// -----------------------------------------------------------------------------
+// Write a rectangle of the shadow through to the FPGA, one run per row
+// -----------------------------------------------------------------------------
+static void sfb_push_rect(struct fb_info *info, u32 x, u32 y, u32 w, u32 h)
+{
+    unsigned long bpp = info->var.bits_per_pixel >> 3;
+    unsigned long p   = y * SFB_LINE + x * bpp;
+
+    sfb_blt_wait();
+    for(; h; h--, y++, p += SFB_LINE)
+        sfb_write_run(sfb_io + SFB_ROW(y) + x * bpp, (u8 *)info->screen_base + p, w * bpp);
+}
+
+// -----------------------------------------------------------------------------
+// Fill n bytes of one DRAM row with a 32 bit pattern, no read back
+// -----------------------------------------------------------------------------
+static inline void sfb_fill_run(void __iomem *dst, u32 pat, unsigned long n)
+{
+    while(((unsigned long)dst & 3) && n) {      // Align head to 32 bits
+        fb_writeb(pat, dst);
+        pat = (pat >> 8) | (pat << 24);
+        dst++;
+        n--;
+    }
+    while(n >= 16) {                            // Unrolled word fill
+        fb_writel(pat, dst     );
+        fb_writel(pat, dst +  4);
+        fb_writel(pat, dst +  8);
+        fb_writel(pat, dst + 12);
+        dst += 16;
+        n   -= 16;
+    }
+    for(; n >= 4; n -= 4, dst += 4) fb_writel(pat, dst);
+    for(; n; n--, dst++, pat >>= 8) fb_writeb(pat, dst);
+}
+
+// -----------------------------------------------------------------------------
+static void sfb_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
+{
+    u32 x = rect->dx, y = rect->dy, w = rect->width, h = rect->height;
+    u32 bpp = info->var.bits_per_pixel >> 3;
+    u32 pat, off, i;
+
+    if(!sfb_clip(info, x, y, &w, &h)) return;
+    pat = sfb_pixel(info, rect->color);
+    if(bpp == 1) pat = (pat & 0xFF) * 0x01010101;           // 32 bit fill pattern
+    else         pat = (pat & 0xFFFF) * 0x00010001;
+    if(blit && rect->rop == ROP_COPY) {         // The FPGA fills, the shadow follows
+        if(shadow) sys_fillrect(info, rect);
+        if(!sfb_blt_fill(info, x, y, w, h, pat)) return;
+        if(shadow) {                            // Engine busy, write the shadow through
+            sfb_push_rect(info, x, y, w, h);
+            return;
+        }
+    }
+    if(shadow) {
+        sys_fillrect(info, rect);
+        sfb_push_rect(info, x, y, w, h);
+        return;
+    }
+
+    sfb_blt_wait();
+    off = (x * bpp) & 3;                        // Co-align with the FPGA row
+    for(; h; h--, y++) {
+        void __iomem *dst = sfb_io + SFB_ROW(y) + x * bpp;
+        if(rect->rop == ROP_XOR) {              // XOR has to read the row back
+            sfb_read_run((u8 *)sfb_linebuf + off, dst, w * bpp);
+            for(i = 0; i < (off + w * bpp + 3) / 4; i++) sfb_linebuf[i] ^= pat;
+            sfb_write_run(dst, (u8 *)sfb_linebuf + off, w * bpp);
+        }
+        else sfb_fill_run(dst, pat, w * bpp);
+    }
+}
+
+// -----------------------------------------------------------------------------
+static void sfb_copyarea(struct fb_info *info, const struct fb_copyarea *area)
+{
+    u32 w = area->width, h = area->height, sy = area->sy, dy = area->dy;
+    u32 bpp = info->var.bits_per_pixel >> 3;
+    u32 soff, doff, n;
+    int step = 1;
+
+    if(!sfb_clip(info, area->dx, area->dy, &w, &h)) return;
+    if(!sfb_clip(info, area->sx, area->sy, &w, &h)) return;
+    if(blit) {                                  // The FPGA copies, the shadow follows
+        if(sfb_flush_pending(info))             // The engine reads the FPGA, bring the
+            sfb_push_rect(info, area->sx, area->sy, w, h);   // source up to date first
+        if(shadow) sys_copyarea(info, area);
+        if(!sfb_blt_copy(info, area->sx, area->sy, area->dx, area->dy, w, h)) return;
+        if(shadow) {                            // Engine busy, write the shadow through
+            sfb_push_rect(info, area->dx, area->dy, w, h);
+            return;
+        }
+    }
+    if(shadow) {
+        sys_copyarea(info, area);
+        sfb_push_rect(info, area->dx, area->dy, w, h);
+        return;
+    }
+
+    sfb_blt_wait();
+    if(dy > sy) {                               // Overlapping downward copy, go bottom up
+        sy  += h - 1;
+        dy  += h - 1;
+        step = -1;
+    }
+    soff = (area->sx * bpp) & 3;                // Co-align the buffer with each row
+    doff = (area->dx * bpp) & 3;
+    n    = w * bpp;
+    for(; h; h--, sy += step, dy += step) {     // Whole row span is buffered, so
+        sfb_read_run((u8 *)sfb_linebuf + soff,  // same row overlap is safe
+                     sfb_io + SFB_ROW(sy) + area->sx * bpp, n);
+        if(soff != doff)                        // Re-align the buffer to the destination
+            memmove((u8 *)sfb_linebuf + doff, (u8 *)sfb_linebuf + soff, n);
+        sfb_write_run(sfb_io + SFB_ROW(dy) + area->dx * bpp, (u8 *)sfb_linebuf + doff, n);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Monochrome images (the console font) are expanded by the FPGA, or one row
+// at a time in the line buffer without the 2D engine. Images already in the
+// screen format are written as is.
+// -----------------------------------------------------------------------------
+static void sfb_imageblit(struct fb_info *info, const struct fb_image *image)
+{
+    u32 x = image->dx, y = image->dy, w = image->width, h = image->height;
+    u32 bpp = info->var.bits_per_pixel >> 3;
+    u32 pitch, fg, bg, i;
+    const u8 *src = (const u8 *)image->data;
+    u8  *buf;
+
+    if(!sfb_clip(info, x, y, &w, &h)) return;
+    fg = sfb_pixel(info, image->fg_color);
+    bg = sfb_pixel(info, image->bg_color);
+    if(blit && image->depth == 1) {             // The FPGA expands, the shadow follows
+        if(shadow) sys_imageblit(info, image);
+        if(bpp == 1) {                          // Engine takes the index in both bytes
+            fg = (fg & 0xFF) * 0x0101;          // the software path uses the low one
+            bg = (bg & 0xFF) * 0x0101;
+        }
+        if(!sfb_blt_expand(info, image, w, h, fg, bg)) return;
+        if(shadow) {                            // Engine busy, write the shadow through
+            sfb_push_rect(info, x, y, w, h);
+            return;
+        }
+    }
+    if(shadow) {
+        sys_imageblit(info, image);
+        sfb_push_rect(info, x, y, w, h);
+        return;
+    }
+    if(image->depth != 1 && image->depth != info->var.bits_per_pixel) {
+        sfb_blt_wait();
+        cfb_imageblit(info, image);             // Logo and friends, linear layout only
+        return;
+    }
+
+    sfb_blt_wait();
+    buf = (u8 *)sfb_linebuf + ((x * bpp) & 3);  // Co-align with the FPGA row
+    if(image->depth == 1) {
+        pitch = (image->width + 7) / 8;
+        for(; h; h--, y++, src += pitch) {
+            if(bpp == 1) for(i = 0; i < w; i++) buf[i] = (src[i >> 3] & (0x80 >> (i & 7))) ? fg : bg;
+            else for(i = 0; i < w; i++) ((u16 *)buf)[i] = (src[i >> 3] & (0x80 >> (i & 7))) ? fg : bg;
+            sfb_write_run(sfb_io + SFB_ROW(y) + x * bpp, buf, w * bpp);
+        }
+    }
+    else {
+        pitch = image->width * bpp;
+        for(; h; h--, y++, src += pitch) {
+            memcpy(buf, src, w * bpp);
+            sfb_write_run(sfb_io + SFB_ROW(y) + x * bpp, buf, w * bpp);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+// Text mode. The FPGA can scan out TXT_COLS x TXT_ROWS character cells from
+// DRAM row TXT_ROW up, a character byte and an attribute byte per cell, with
+// the glyphs in an FPGA font RAM and the 16 console colors in the CLUT. With
+// text=1, fbcon draws through these tile operations and writes 2 bytes per
+// character instead of the glyph's pixels. The mode follows FB_ACCELF_TEXT
+// in accel_flags, so a program that clears it gets the graphics screen.
 // -----------------------------------------------------------------------------
-int            sfb_init(void);
-int            sfb_setup(char *);
-static int     sfb_check_var(struct fb_var_screeninfo *var, struct fb_info *info);
-static int     sfb_set_par(struct fb_info *info);
-static ssize_t sfb_read(struct fb_info *info, char *buf, size_t count, loff_t * ppos);
-static ssize_t sfb_write(struct fb_info *info, const char *buf, size_t count, loff_t * ppos);
-static int     sfb_setcolreg(unsigned regno, unsigned r, unsigned g, unsigned b, unsigned transp, struct fb_info *info);
-static int     sfb_blank(int blank_mode, struct fb_info *info);
+#define SFB_CELL(x, y)   (sfb_io + SFB_ROW(TXT_ROW + (y)) + (x) * 2)         // Cell address
+#define SFB_ATTR(fg, bg) ((((bg) & 0xF) << 12) | (((fg) & 0xF) << 8))       // Attribute, high byte
 
 // -----------------------------------------------------------------------------
-// Define fb_ops structure that is registered with the kernel.
-// Note: The cfb_xxx routines, these are generic routines implemented in kernel.
-// You can override them in case your hardware provides accelerated graphics function
+// Load the console font into the FPGA font RAM
 // -----------------------------------------------------------------------------
-static struct fb_ops sfb_ops = {
-    .owner        = THIS_MODULE,
+static void sfb_settile(struct fb_info *info, struct fb_tilemap *map)
+{
+    const u8 *font = map->data;
+    u32 i, n;
 
-    .fb_check_var = sfb_check_var,     // Check variables
-    .fb_set_par   = sfb_set_par,
+    if(map->width != TXT_FONT_W || map->height != TXT_FONT_H || map->depth != 1) return;
+    n = min_t(u32, map->length, 256) * TXT_FONT_H;
+    sfb_reg_writew(0, TXT_REG(TXT_REG_ADDR));
+    for(i = 0; i < n; i++) fb_writeb(font[i], TXT_REG(TXT_REG_DATA));
+}
 
-    .fb_fillrect  = cfb_fillrect,      // use standard functions
-    .fb_copyarea  = cfb_copyarea,      // use standard functions
-    .fb_imageblit = cfb_imageblit,     // use standard functions
+// -----------------------------------------------------------------------------
+// Move a rectangle of cells, one row run at a time like sfb_copyarea
+// -----------------------------------------------------------------------------
+static void sfb_tilecopy(struct fb_info *info, struct fb_tilearea *area)
+{
+    u32 n = area->width * 2, h = area->height, sy = area->sy, dy = area->dy;
+    u32 soff = (area->sx * 2) & 3, doff = (area->dx * 2) & 3;
+    int step = 1;
 
-    .fb_read      = sfb_read,          // Special read function
-    .fb_write     = sfb_write,         // Special read function
+    if(sy >= TXT_ROWS || dy >= TXT_ROWS) return;        // Rows past the cells are not scanned out
+    if(area->sx >= TXT_COLS || area->dx >= TXT_COLS) return;
+    h = min_t(u32, h, TXT_ROWS - max(sy, dy));
+    n = min_t(u32, n, (TXT_COLS - max(area->sx, area->dx)) * 2);
+    if(blit && !sfb_blt_move(area->sx * 2, TXT_ROW + sy, area->dx * 2, TXT_ROW + dy, n, h)) return;
+    if(dy > sy) {                               // Overlapping downward copy, go bottom up
+        sy  += h - 1;
+        dy  += h - 1;
+        step = -1;
+    }
+    for(; h; h--, sy += step, dy += step) {
+        sfb_read_run((u8 *)sfb_linebuf + soff, SFB_CELL(area->sx, sy), n);
+        if(soff != doff) memmove((u8 *)sfb_linebuf + doff, (u8 *)sfb_linebuf + soff, n);
+        sfb_write_run(SFB_CELL(area->dx, dy), (u8 *)sfb_linebuf + doff, n);
+    }
+}
 
-    .fb_setcolreg = sfb_setcolreg,     // Set color register
-    .fb_blank     = sfb_blank,         // Blank Display
-};
+// -----------------------------------------------------------------------------
+// Fill a rectangle of cells with one character
+// -----------------------------------------------------------------------------
+static void sfb_tilefill(struct fb_info *info, struct fb_tilerect *rect)
+{
+    u32 cell = SFB_ATTR(rect->fg, rect->bg) | (rect->index & 0xFF);
+    u32 y, w, h;
+
+    if(rect->sy >= TXT_ROWS || rect->sx >= TXT_COLS) return;
+    h = min_t(u32, rect->height, TXT_ROWS - rect->sy);
+    w = min_t(u32, rect->width, TXT_COLS - rect->sx);
+    if(blit && !sfb_blt_paint(rect->sx * 2, TXT_ROW + rect->sy, w * 2, h, cell)) return;
+    for(y = rect->sy; y < rect->sy + h; y++)
+        sfb_fill_run(SFB_CELL(rect->sx, y), cell * 0x00010001, w * 2);
+}
 
 // -----------------------------------------------------------------------------
-// For now this is a stub. Later will need to put in code to toggle a
-// GPIO line tied to the LCD controller enable line.
+// Write a string of characters, built up a row at a time in the line buffer
 // -----------------------------------------------------------------------------
-#define GPIO_PIN        11                  // Set Pin Number here
-#define LCD_ENABLE_PIN (1 << GPIO_PIN)     // Compute bit mask
-static void lcd_enable(int enable)
+static void sfb_tileblit(struct fb_info *info, struct fb_tileblit *tb)
 {
-    unsigned long *portptr;
-    portptr = ioremap(PIOB_BASE, 1024);    // Initialize AT91 GPIO REG
-    if(enable) portptr[PIO_SODR] = LCD_ENABLE_PIN;   // Set bit
-    else       portptr[PIO_CODR] = LCD_ENABLE_PIN;   // clear bit
+    u32 attr = SFB_ATTR(tb->fg, tb->bg);
+    u32 x, y, i = 0;
+    u16 *cells = (u16 *)sfb_linebuf + (tb->sx & 1);     // Co-align with the FPGA row
+    u32 w;
+
+    if(tb->sx >= TXT_COLS) return;
+    w = min_t(u32, tb->width, TXT_COLS - tb->sx);       // Columns past the cells are not scanned out
+    sfb_blt_wait();
+    for(y = tb->sy; y < tb->sy + tb->height && y < TXT_ROWS && i < tb->length; y++) {
+        for(x = 0; x < tb->width && i < tb->length; x++, i++)
+            if(x < w) cells[x] = attr | (tb->indices[i] & 0xFF);
+        x = min(x, w);
+        sfb_write_run(SFB_CELL(tb->sx, y), (u8 *)cells, x * 2);
+    }
 }
 
 // -----------------------------------------------------------------------------
-// sfb_blank - blanks the display.
-//      @blank_mode: the blank mode we want.
-//      @info: frame buffer structure that represents a single frame buffer
-//
-//  Blank the screen if blank_mode != 0, else unblank. Return 0 if
-//    blanking succeeded, != 0 if un-/blanking failed due to e.g. a
-//    video mode which doesn't support it. Implements VESA suspend
-//    and powerdown modes on hardware that supports disabling hsync/vsync:
-//    blank_mode == 2: suspend vsync
-//    blank_mode == 3: suspend hsync
-//    blank_mode == 4: powerdown
-//
-//  Returns negative errno on error, or zero on success.
+// Text cursor on the hardware sprite, the bottom lines of the cell inverted
 // -----------------------------------------------------------------------------
-static int sfb_blank(int blank_mode, struct fb_info *info)
+static void sfb_tilecursor(struct fb_info *info, struct fb_tilecursor *cursor)
 {
-    switch(blank_mode) {
-        case FB_BLANK_UNBLANK:
-        case FB_BLANK_NORMAL:
-            lcd_enable(1);
-            break;
-        case FB_BLANK_VSYNC_SUSPEND:
-        case FB_BLANK_HSYNC_SUSPEND:
-            lcd_enable(0);
-            break;
-        case FB_BLANK_POWERDOWN:
-            lcd_enable(0);
-            break;
-        default:
-            return(-EINVAL);
+    static const u8 lines[] = {                 // Lines covered by each FB_TILE_CURSOR_ shape
+        0, TXT_FONT_H / 8, TXT_FONT_H / 3, TXT_FONT_H / 2, TXT_FONT_H * 2 / 3, TXT_FONT_H
+    };
+    u32 x, y, n;
+
+    if(cursor->shape != sfb_tile_shape) {       // Redraw the sprite only on a shape change
+        n = lines[cursor->shape < ARRAY_SIZE(lines) ? cursor->shape : FB_TILE_CURSOR_UNDERLINE];
+        fb_writeb(0, CUR_REG(CUR_REG_ADDR));
+        for(y = 0; y < CUR_SIZE; y++)
+            for(x = 0; x < CUR_SIZE / 4; x++)   // 11 = invert, 4 pixels per byte
+                fb_writeb((x < TXT_FONT_W / 4 && y >= TXT_FONT_H - n && y < TXT_FONT_H) ? 0xFF : 0x00,
+                          CUR_REG(CUR_REG_DATA));
+        fb_writeb(0, CUR_REG(CUR_REG_HOTX));
+        fb_writeb(0, CUR_REG(CUR_REG_HOTY));
+        sfb_tile_shape = cursor->shape;
     }
-    // let fbcon do a soft blank for us
-    return(blank_mode == FB_BLANK_NORMAL) ? 1 : 0;
+    sfb_reg_writew(cursor->sx * TXT_FONT_W, CUR_REG(CUR_REG_X));
+    sfb_reg_writew(cursor->sy * TXT_FONT_H, CUR_REG(CUR_REG_Y));
+    fb_writeb(cursor->mode ? CUR_CTRL_EN : 0, CUR_REG(CUR_REG_CTRL));
 }
 
 // -----------------------------------------------------------------------------
-// sfb_setcolreg - sets a color register.
-//     regno:  Which register in the CLUT we are programming
-//     red:    The red value which can be up to 16 bits wide
-//     green:  The green value which can be up to 16 bits wide
-//     blue:   The blue value which can be up to 16 bits wide.
-//     transp: If supported the alpha value which can be up to 16 bits wide.
-//     info:   frame buffer info structure
-//
-// Returns negative errno on error, or zero on success.
+static int sfb_get_tilemax(struct fb_info *info)
+{
+    return(256);
+}
+
+static struct fb_tile_ops sfb_tileops = {
+    .fb_settile     = sfb_settile,      // Load the font
+    .fb_tilecopy    = sfb_tilecopy,     // Move cells
+    .fb_tilefill    = sfb_tilefill,     // Clear cells
+    .fb_tileblit    = sfb_tileblit,     // Write characters
+    .fb_tilecursor  = sfb_tilecursor,   // Text cursor
+    .fb_get_tilemax = sfb_get_tilemax,  // Characters in the font RAM
+};
+
 // -----------------------------------------------------------------------------
-static int sfb_setcolreg(unsigned regno, unsigned r, unsigned g,unsigned b, unsigned transp, struct fb_info *info)
+// SFBIO_UPLOAD - copy a list of user rectangles to the screen in one call.
+// Each source line goes through the bounce buffer (or lands in the shadow)
+// and is written out as a single row run at its translated DRAM address.
+// -----------------------------------------------------------------------------
+static int sfb_upload(struct fb_info *info, const struct sfb_upload __user *argp)
 {
-    if(regno >= SFB_MAX_PALLETE_REG) return(1); //no. of hw registers
+    unsigned long bpp = info->var.bits_per_pixel >> 3;
+    struct sfb_upload up;
+    struct sfb_rect r;
+    const u8 __user *src;
+    u32 w, h, y, i;
+    u8 *bounce, *dst;
+    int ret = 0;
 
-//  ((u32 *) info->pseudo_palette)[regno]  = (r  << info->var.red.offset) | (g      << info->var.green.offset) |
-//                                           (b << info->var.blue.offset) | (transp << info->var.transp.offset);
+    if(copy_from_user(&up, argp, sizeof(up))) return(-EFAULT);
+    if(up.count > SFB_MAX_RECTS)               return(-EINVAL);
 
-    ((u32 *) info->pseudo_palette)[regno] = (r & 0xf800) | (g & 0xfc00) >> 5 | (b & 0xf800) >> 11;
-    return(0);
+    bounce = kmalloc(LCD_PITCH + 4, GFP_KERNEL);
+    if(!bounce) return(-ENOMEM);
+    if(sfb_wq) flush_workqueue(sfb_wq);         // Keep ordered with queued writes
+    sfb_blt_wait();
+
+    for(i = 0; i < up.count; i++) {
+        if(copy_from_user(&r, up.rects + i, sizeof(r))) {
+            ret = -EFAULT;
+            break;
+        }
+        w = r.w;
+        h = r.h;
+        if(!sfb_clip(info, r.x, r.y, &w, &h)) continue;
+
+        src = (const u8 __user *)r.src;
+        for(y = r.y; h; h--, y++, src += r.stride) {
+            if(shadow) dst = (u8 *)info->screen_base + y * SFB_LINE + r.x * bpp;
+            else       dst = bounce + ((r.x * bpp) & 3);       // Co-align with the FPGA row
+            if(copy_from_user(dst, src, w * bpp)) {
+                ret = -EFAULT;
+                break;
+            }
+            sfb_write_run(sfb_io + SFB_ROW(y) + r.x * bpp, dst, w * bpp);
+        }
+        if(ret) break;
+    }
+    kfree(bounce);
+    return(ret);
 }
 
 // -----------------------------------------------------------------------------
-// By reading and writing along the video DRAM row and column boundaries
-// it speeds up the graphics by 50%
+// SFBIO_RLE - draw a run length encoded rectangle. Whole rows of the stream
+// are gathered into a buffer load for the FPGA, which expands the runs into
+// DRAM itself, so a flat area crosses the bus as 4 bytes. Without the 2D
+// engine, and into the shadow, the rows are expanded here.
 // -----------------------------------------------------------------------------
-#define TRANSLATE_ADDRESS  1
-#if TRANSLATE_ADDRESS
-#define TRANSLATE(a)       (((((unsigned long)a)/1280)&0x01FF)<<11) | ((((unsigned long)a)%1280)&0x07FF); 
-#else
-#define TRANSLATE(a)       (unsigned long)(a)
-#endif
+#define SFB_RLE_WORDS(hdr, bpp) (((hdr) & SFB_RLE_RUN) ? 1 :                    \
+                                 (bpp) == 1 ? (((hdr) & SFB_RLE_COUNT) + 2) / 2 :  \
+                                              ((hdr) & SFB_RLE_COUNT) + 1)
+
+// -----------------------------------------------------------------------------
+// Words in the next row of a stream already copied in, -EINVAL if the packets
+// do not make up exactly w pixels, -ENOSPC if the row runs past words
 // -----------------------------------------------------------------------------
-static inline void sfb_fb_writew(u16 v, void *base, void *a)
+static int sfb_rle_row(const u16 *src, u32 words, u32 w, u32 bpp)
 {
-    u16 *p;
-#if TRANSLATE_ADDRESS
-    unsigned long m = ((unsigned long)a);
-    m = (((m/1280)&0x01FF)<<11) | ((m%1280)&0x07FF);
-    p = (u16 *)(m + (unsigned long)base);
-#else
-    p = (u16 *)(TRANSLATE(a) + (unsigned long)base);
-#endif
-    fb_writew(v, p);
+    u32 n = 0, px;
+    u16 hdr;
+
+    while(w) {
+        if(n >= words)               return(-ENOSPC);
+        hdr = le16_to_cpu(src[n]);
+        px  = (hdr & SFB_RLE_COUNT) + 1;
+        if(px > w)                   return(-EINVAL);
+        w  -= px;
+        n  += 1 + SFB_RLE_WORDS(hdr, bpp);
+    }
+    return(n <= words ? n : -ENOSPC);
 }
-static inline void sfb_fb_writeb(u8 v, void *base, void *a)
-{
-    u16 *p;
 
-#if TRANSLATE_ADDRESS
-    unsigned long m = (unsigned long)a;
-    m = (((m/1280)&0x01FF)<<11) | ((m%1280)&0x07FF);
-    p = (u16 *)(m + (unsigned long)base);
-#else
-    p = (u16 *)(TRANSLATE(a) + (unsigned long)base);
-#endif
+// -----------------------------------------------------------------------------
+// Expand one row of a checked stream to w pixels at dst, returns the next row
+// -----------------------------------------------------------------------------
+static const u16 *sfb_rle_decode(u8 *dst, const u16 *src, u32 w, u32 bpp)
+{
+    u32 px, i;
+    u16 hdr, c;
 
-    fb_writeb(v, p);
+    for(; w; w -= px) {
+        hdr = le16_to_cpu(*src++);
+        px  = (hdr & SFB_RLE_COUNT) + 1;
+        if(px > w) break;                       // Never past the row, checked or not
+        if(hdr & SFB_RLE_RUN) {
+            c = le16_to_cpu(*src);
+            if(bpp == 1) memset(dst, c & 0xFF, px);
+            else for(i = 0; i < px; i++) {      // Low byte to the even column
+                dst[2 * i]     = c;
+                dst[2 * i + 1] = c >> 8;
+            }
+        }
+        else memcpy(dst, src, px * bpp);
+        src += SFB_RLE_WORDS(hdr, bpp);
+        dst += px * bpp;
+    }
+    return(src);
 }
-static inline u16 sfb_fb_readw(void *base, void *a)
+
+// -----------------------------------------------------------------------------
+// Draw h rows of stream at x, y, bounce is a DRAM row of scratch
+// -----------------------------------------------------------------------------
+static void sfb_rle_draw(struct fb_info *info, const u16 *stream, u32 words,
+                         u32 x, u32 y, u32 w, u32 h, u8 *bounce)
 {
-    u16 *p;
+    unsigned long bpp = info->var.bits_per_pixel >> 3;
+    unsigned long flags;
+    const u16 *src = stream;
+    u32 i;
 
-#if TRANSLATE_ADDRESS
-    unsigned long m = (unsigned long)a;
-    m = (((m/1280)&0x01FF)<<11) | ((m%1280)&0x07FF);
-    p = (u16 *)(m + (unsigned long)base);
-#else
-    p = (u16 *)(TRANSLATE(a) + (unsigned long)base);
-#endif
+    if(shadow)                                  // The shadow follows the engine
+        for(i = 0; i < h; i++)
+            src = sfb_rle_decode((u8 *)info->screen_base + (y + i) * SFB_LINE + x * bpp, src, w, bpp);
+    if(blit) {
+        spin_lock_irqsave(&sfb_blt_lock, flags);
+        if(!sfb_blt_wait()) {                   // Buffer is free once the engine is idle
+            sfb_reg_writew(0, RLE_REG(RLE_REG_ADDR));
+            for(i = 0; i < words * 2; i++) fb_writeb(((const u8 *)stream)[i], RLE_REG(RLE_REG_DATA));
+            sfb_reg_writew(x * bpp, BLT_REG(BLT_REG_DCOL));
+            sfb_reg_writew(y & (LCD_ROWS - 1), BLT_REG(BLT_REG_DROW));
+            sfb_reg_writew(w * bpp, BLT_REG(BLT_REG_WIDTH));
+            sfb_reg_writew(h, BLT_REG(BLT_REG_HGT));
+            fb_writeb(BLT_CMD_RLE, BLT_REG(BLT_REG_CMD));
+            spin_unlock_irqrestore(&sfb_blt_lock, flags);
+            return;
+        }
+        spin_unlock_irqrestore(&sfb_blt_lock, flags);
+    }
 
-    return(fb_readw(p));
+    if(shadow) {                                // No engine, or it is busy
+        sfb_push_rect(info, x, y, w, h);
+        return;
+    }
+    for(src = stream, i = 0; i < h; i++) {
+        u8 *dst = bounce + ((x * bpp) & 3);     // Co-align with the FPGA row
+        src = sfb_rle_decode(dst, src, w, bpp);
+        sfb_write_run(sfb_io + SFB_ROW(y + i) + x * bpp, dst, w * bpp);
+    }
 }
-static inline u8 sfb_fb_readb(void *base, void *a)
+
+static int sfb_rle(struct fb_info *info, const struct sfb_rle __user *argp)
 {
-    u16 *p;
+    unsigned long bpp = info->var.bits_per_pixel >> 3;
+    struct sfb_rle rle;
+    const u16 __user *src;
+    u32 left, have, n, k, y, y0;
+    u16 *buf;
+    int len, full, ret = 0;
 
-#if TRANSLATE_ADDRESS
-    unsigned long m = (unsigned long)a;
-    m = (((m/1280)&0x01FF)<<11) | ((m%1280)&0x07FF);
-    p = (u16 *)(m + (unsigned long)base);
-#else
-    p = (u16 *)(TRANSLATE(a) + (unsigned long)base);
-#endif
-    return(fb_readb(p));
+    if(copy_from_user(&rle, argp, sizeof(rle))) return(-EFAULT);
+    if(rle.x + rle.w > info->var.xres_virtual || rle.y + rle.h > info->var.yres_virtual) return(-EINVAL);
+
+    buf = kmalloc(RLE_BUF_SIZE + LCD_PITCH + 4, GFP_KERNEL);
+    if(!buf) return(-ENOMEM);
+    if(sfb_wq) flush_workqueue(sfb_wq);         // Keep ordered with queued writes
+    sfb_blt_wait();
+
+    // The stream is copied in once and only the copy is checked and decoded,
+    // buf[0, n) holds checked rows, buf[n, have) copied but unchecked words
+    src  = rle.data;
+    left = rle.size / 2;                        // Words still in user memory
+    have = n = 0;
+    y    = y0 = rle.y;
+    while(rle.w && y < rle.y + rle.h) {
+        len = sfb_rle_row(buf + n, have - n, rle.w, bpp);
+        if(len == -ENOSPC && left && have < RLE_BUF_SIZE / 2) {
+            k = min(left, RLE_BUF_SIZE / 2 - have);   // Top up the buffer load
+            if(copy_from_user(buf + have, src, k * 2)) {
+                ret = -EFAULT;
+                break;
+            }
+            src  += k;
+            left -= k;
+            have += k;
+            continue;
+        }
+        full = (len == -ENOSPC) ||              // Buffer load full, or as much as one
+               (len > 0 && (y + 1 - y0) * rle.w * bpp > SFB_BLT_BAND);   // engine command should draw
+        if(full && n) {
+            sfb_rle_draw(info, buf, n, rle.x, y0, rle.w, y - y0, (u8 *)buf + RLE_BUF_SIZE);
+            memmove(buf, buf + n, (have - n) * 2);
+            have -= n;
+            n     = 0;
+            y0    = y;
+            continue;
+        }
+        if(len < 0) {                           // Bad packets, or a row bigger than a load
+            ret = -EINVAL;
+            break;
+        }
+        n += len;
+        y++;
+    }
+    if(y > y0) sfb_rle_draw(info, buf, n, rle.x, y0, rle.w, y - y0, (u8 *)buf + RLE_BUF_SIZE);
+    kfree(buf);
+    return(ret);
 }
 
-static inline unsigned long copy_from_user16(void *base, void *to, void *from, unsigned long n)
+// -----------------------------------------------------------------------------
+// SFBIO_OVERLAY - show a YUV frame held in spare frame buffer rows in a window
+// of the screen, converted to RGB by the FPGA as it scans out. The player
+// writes each frame through mmap or write() and calls this again with the new
+// rows to flip to it, the FPGA takes them at the next vblank.
+// -----------------------------------------------------------------------------
+static int sfb_overlay(struct fb_info *info, const struct sfb_overlay __user *argp)
 {
-    u16 *dst = (u16 *) to;
-    u16 *src = (u16 *) from;
+    struct sfb_overlay ov;
+    u8 ctrl;
 
-    if(!access_ok(VERIFY_READ, from, n)) return(n);
-
-    while(n > 1) {
-       u16 v;
-       if(__get_user(v, src)) return(n);
-       sfb_fb_writew(v, base, dst);
-       src++, dst++;
-       n -= 2;
+    if(copy_from_user(&ov, argp, sizeof(ov))) return(-EFAULT);
+    if(!ov.enable) {
+        fb_writeb(0, OVL_REG(OVL_REG_CTRL));
+        return(0);
     }
-    if(n) {
-        u8 v;
-        if(__get_user(v, ((u8 *) src))) return(n);
-        sfb_fb_writeb(v, base, dst);
+    if(TRANSLATE_ADDRESS) return(-ENODEV);      // The FPGA fetches whole DRAM rows
+    if(!ov.w || !ov.h || (ov.w & 1))            return(-EINVAL);
+    if(ov.x + ov.w > LCD_WIDTH || ov.y + ov.h > LCD_HEIGHT) return(-EINVAL);
+    if(ov.row + ov.h > SFB_ROWS)                return(-EINVAL);
+    switch(ov.format) {
+        case SFB_OVL_YUYV:
+            ctrl = OVL_CTRL_EN;
+            break;
+        case SFB_OVL_YUV420:
+            if(ov.crow + (ov.h + 1) / 2 > SFB_ROWS) return(-EINVAL);
+            ctrl = OVL_CTRL_EN | OVL_CTRL_420;
+            break;
+        default:
+            return(-EINVAL);
     }
+
+    sfb_drain(info);                            // The new frame must be complete
+    sfb_reg_writew(ov.x,    OVL_REG(OVL_REG_X));
+    sfb_reg_writew(ov.y,    OVL_REG(OVL_REG_Y));
+    sfb_reg_writew(ov.w,    OVL_REG(OVL_REG_W));
+    sfb_reg_writew(ov.h,    OVL_REG(OVL_REG_H));
+    sfb_reg_writew(ov.row,  OVL_REG(OVL_REG_ROW));
+    sfb_reg_writew(ov.crow, OVL_REG(OVL_REG_CROW));
+    fb_writeb(ctrl, OVL_REG(OVL_REG_CTRL));
     return(0);
 }
 
-static inline unsigned long copy_to_user16(void *base, void *to, void *from, unsigned long n)
+// -----------------------------------------------------------------------------
+// sfb_ioctl - driver specific ioctls, called with the fb_info lock held
+// -----------------------------------------------------------------------------
+static int sfb_ioctl(struct fb_info *info, unsigned int cmd, unsigned long arg)
 {
-    u16 *dst = (u16 *) to;
-    u16 *src = (u16 *) from;
+    struct fb_vblank vblank;
+    u32 crtc, seq;
 
-    if(!access_ok(VERIFY_WRITE, to, n)) return(n);
+    switch(cmd) {
+        case SFBIO_UPLOAD:
+            return(sfb_upload(info, (const struct sfb_upload __user *)arg));
 
-    while(n > 1) {
-        u16 v = sfb_fb_readw(base, src);
-        if(__put_user(v, dst)) return(n);
-        src++, dst++;
-        n -= 2;
-    }
-    if(n) {
-        u8 v = sfb_fb_readb(base, src);
-        if(__put_user(v, ((u8 *) dst))) return(n);
+        case SFBIO_RLE:
+            return(sfb_rle(info, (const struct sfb_rle __user *)arg));
+
+        case SFBIO_OVERLAY:
+            return(sfb_overlay(info, (const struct sfb_overlay __user *)arg));
+
+        case SFBIO_FENCE:
+            seq = sfb_fence(info);
+            return(put_user(seq, (u32 __user *)arg));
+
+        case SFBIO_WAIT:
+            if(get_user(seq, (u32 __user *)arg)) return(-EFAULT);
+            return(sfb_wait_fence(seq));
+
+        case FBIO_WAITFORVSYNC:
+            if(get_user(crtc, (u32 __user *)arg)) return(-EFAULT);
+            if(crtc) return(-EINVAL);            // Only one display
+            return(sfb_wait_for_vsync(info));
+
+        case FBIOGET_VBLANK:
+            memset(&vblank, 0, sizeof(vblank));
+            vblank.flags = FB_VBLANK_HAVE_VBLANK;
+            if(sfb_irq >= 0) vblank.flags |= FB_VBLANK_HAVE_COUNT;
+            if(fb_readb(SFB_REG(LCD_REG_STAT)) & LCD_STAT_VBL) vblank.flags |= FB_VBLANK_VBLANKING;
+            vblank.count = sfb_vbl_count;
+            if(copy_to_user((void __user *)arg, &vblank, sizeof(vblank))) return(-EFAULT);
+            return(0);
+
+        default:
+            return(-ENOTTY);
     }
-    return(0);
 }
 
-
 // -----------------------------------------------------------------------------
 // By reading and writing along the video DRAM row and column boundaries
-// it speeds up the graphics by 50%
+// it speeds up the graphics by 50%. With a shadow, reads come from RAM.
 // -----------------------------------------------------------------------------
 static ssize_t sfb_read(struct fb_info *info, char *buf, size_t count, loff_t * ppos)
 {
@@ -304,9 +1671,11 @@ static ssize_t sfb_read(struct fb_info *info, char *buf, size_t count, loff_t *
     if(count + p > info->fix.smem_len) count = info->fix.smem_len - p;
 
     if(count) {
-        char *base_addr;
-        base_addr = info->screen_base;
-        count -= copy_to_user16((void *)base_addr, (void *)buf, (void *)p, count);
+        if(shadow) count -= copy_to_user(buf, info->screen_base + p, count);
+        else {
+            if(sfb_wq) flush_workqueue(sfb_wq); // Read back what was queued
+            count -= sfb_copy_to_user(sfb_io, p, buf, count);
+        }
         if(!count) return -EFAULT;
         *ppos += count;
     }
@@ -315,7 +1684,9 @@ static ssize_t sfb_read(struct fb_info *info, char *buf, size_t count, loff_t *
 
 // -----------------------------------------------------------------------------
 // By reading and writing along the video DRAM row and column boundaries
-// it speeds up the graphics by 50%
+// it speeds up the graphics by 50%. With a shadow, the data is copied to RAM
+// and flushed by the deferred worker. With async, it is queued to the async
+// worker and the caller finds out when it landed with fsync or SFBIO_WAIT.
 // -----------------------------------------------------------------------------
 static ssize_t sfb_write(struct fb_info *info, const char *buf, size_t count, loff_t * ppos)
 {
@@ -331,10 +1702,14 @@ static ssize_t sfb_write(struct fb_info *info, const char *buf, size_t count, lo
     }
 
     if(count) {
-        char *base_addr;
-        base_addr = info->screen_base;
-
-        count -= copy_from_user16((void *)base_addr, (void *)p, (void *)buf, count);
+        if(shadow) {                    // Into the shadow, then straight through
+            count -= copy_from_user(info->screen_base + p, buf, count);
+            mutex_lock(&sfb_flush_lock);
+            sfb_flush(info, p, count);
+            mutex_unlock(&sfb_flush_lock);
+        }
+        else if(sfb_wq) count -= sfb_queue_from_user(p, buf, count);
+        else            count -= sfb_copy_from_user(sfb_io, p, buf, count);
         *ppos += count;
         err = -EFAULT;
     }
@@ -357,11 +1732,14 @@ static u_long get_line_length(int xres_virtual, int bpp)
 }
 
 // -----------------------------------------------------------------------------
-// We only support 16 bits_per_pixel mode since that is hardware specific. 
+// 16 bits_per_pixel is RGB565, 8 is pseudocolor through the FPGA CLUT. The
+// CLUT scanout fetches one byte per pixel from each DRAM row, so it needs
+// the linear DRAM layout.
 // -----------------------------------------------------------------------------
 static inline int sfb_check_bpp(struct fb_var_screeninfo *var)
 {
     if(var->bits_per_pixel == 16) return(0);
+    if(var->bits_per_pixel == 8 && !TRANSLATE_ADDRESS) return(0);
     else                          return(-EINVAL);
     
 }
@@ -371,6 +1749,17 @@ static inline void sfb_fixup_var_modes(struct fb_var_screeninfo *var)
 {
     switch(var->bits_per_pixel) {
 
+        case 8:   // Pseudocolor, the CLUT holds RGB565
+            var->red.offset    =  0;
+            var->red.length    =  5;
+            var->green.offset  =  0;
+            var->green.length  =  6;
+            var->blue.offset   =  0;
+            var->blue.length   =  5;
+            var->transp.offset =  0;
+            var->transp.length =  0;
+            break;
+
         case 16:  // RGB565 Mode
             var->red.offset    =  0;
             var->red.length    =  5;
@@ -392,6 +1781,63 @@ static inline void sfb_fixup_var_modes(struct fb_var_screeninfo *var)
     var->width            = LCD_WIDTH;
 }
 
+// -----------------------------------------------------------------------------
+// The timing must be one of sfb_modes, a zero pixclock keeps the current
+// mode. The line fetch must also leave room in the line for the overlay and
+// the CPU, which rules out the faster modes at the wider pixel formats. 2x
+// scaled modes use the same panel timing as the native one.
+// Returns negative errno on error, or zero on success.
+// -----------------------------------------------------------------------------
+static int sfb_check_timing(struct fb_var_screeninfo *var, struct fb_info *info)
+{
+    const struct fb_videomode *mode = NULL;
+    u32 want = var->pixclock ? var->pixclock : info->var.pixclock;
+    u32 bytes, line;
+    int i;
+
+    for(i = 0; i < ARRAY_SIZE(sfb_modes); i++)
+        if(sfb_modes[i].pixclock == want) mode = &sfb_modes[i];
+    if(!mode) return(-EINVAL);
+
+    if(var->pixclock) {                         // The whole timing has to match the table
+        if(var->left_margin  != mode->left_margin  || var->right_margin != mode->right_margin ||
+           var->upper_margin != mode->upper_margin || var->lower_margin != mode->lower_margin ||
+           var->hsync_len    != mode->hsync_len    || var->vsync_len    != mode->vsync_len) return(-EINVAL);
+    }
+    else {
+        var->pixclock     = mode->pixclock;
+        var->left_margin  = mode->left_margin;
+        var->right_margin = mode->right_margin;
+        var->upper_margin = mode->upper_margin;
+        var->lower_margin = mode->lower_margin;
+        var->hsync_len    = mode->hsync_len;
+        var->vsync_len    = mode->vsync_len;
+        var->sync         = mode->sync;
+        var->vmode        = mode->vmode;
+    }
+
+    if(text && (var->accel_flags & FB_ACCELF_TEXT)) bytes = TXT_COLS * 2;    // Bytes fetched per line
+    else                                           bytes = var->xres * (var->bits_per_pixel >> 3);
+    line = (LCD_WIDTH + mode->left_margin + mode->right_margin + mode->hsync_len) * (mode->pixclock / 1000);
+    if(bytes * (TIM_FETCH_PS / 1000) * 100 > line * TIM_FETCH_PCT) return(-EINVAL);   // In ns
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// Load the panel timing of the mode, DIV commits it at the end of the frame
+// -----------------------------------------------------------------------------
+static void sfb_set_timing(struct fb_var_screeninfo *var)
+{
+    u8 div = 0;
+
+    while(div < TIM_DIV_MAX && (TIM_PIXCLOCK << div) < var->pixclock) div++;
+    sfb_reg_writew(LCD_WIDTH, TIM_REG(TIM_REG_HACT));
+    sfb_reg_writew(LCD_WIDTH + var->left_margin + var->right_margin + var->hsync_len, TIM_REG(TIM_REG_HTOT));
+    sfb_reg_writew(LCD_HEIGHT, TIM_REG(TIM_REG_VACT));
+    sfb_reg_writew(LCD_HEIGHT + var->upper_margin + var->lower_margin + var->vsync_len, TIM_REG(TIM_REG_VTOT));
+    fb_writeb(div, TIM_REG(TIM_REG_DIV));
+}
+
 // -----------------------------------------------------------------------------
 // sfb_check_var, does not write anything to hardware, only
 // verify based on hardware data for validity
@@ -403,13 +1849,25 @@ static int sfb_check_var(struct fb_var_screeninfo *var, struct fb_info *info)
     if(!var->xres) var->xres = SFB_MIN_X;  // Check for the resolution validity 
     if(!var->yres) var->yres = SFB_MIN_Y;
 
-    if(var->xres > var->xres_virtual) var->xres_virtual = var->xres;
-    if(var->yres > var->yres_virtual) var->yres_virtual = var->yres;
-
     if(sfb_check_bpp(var)) return(-EINVAL);
 
-    if(var->xres_virtual < var->xoffset + var->xres) var->xres_virtual = var->xoffset + var->xres;
-    if(var->yres_virtual < var->yoffset + var->yres) var->yres_virtual = var->yoffset + var->yres;
+    if(var->xres > LCD_WIDTH || var->yres > LCD_HEIGHT) return(-EINVAL);
+    if(var->xres <= LCD_WIDTH / 2 && var->yres <= LCD_HEIGHT / 2 &&      // 2x scaled scanout
+       !(text && (var->accel_flags & FB_ACCELF_TEXT))) {
+        var->xres = LCD_WIDTH / 2;
+        var->yres = LCD_HEIGHT / 2;
+    }
+    else {                                                              // Native scanout
+        var->xres = LCD_WIDTH;
+        var->yres = LCD_HEIGHT;
+    }
+    if(sfb_check_timing(var, info)) return(-EINVAL);
+    if(var->xres_virtual > SFB_LINE * 8 / var->bits_per_pixel) return(-EINVAL);
+    var->xres_virtual = SFB_LINE * 8 / var->bits_per_pixel;   // Pitch is fixed by the FPGA DRAM rows, round up
+    if(var->yres > var->yres_virtual) var->yres_virtual = var->yres;
+
+    if(var->xres_virtual < var->xoffset + var->xres) var->xoffset = 0;
+    if(var->yres_virtual < var->yoffset + var->yres) var->yoffset = 0;
 
     // ------------------------------------------------------------------------
     // Make sure the card has enough video memory in this mode
@@ -417,7 +1875,7 @@ static int sfb_check_var(struct fb_var_screeninfo *var, struct fb_info *info)
     // Fb Memory = Display Width * Display Height * Bytes-per-pixel
     // ------------------------------------------------------------------------
     line_length = get_line_length(var->xres_virtual, var->bits_per_pixel);
-    if(line_length * var->yres_virtual > videomemorysize) return(-ENOMEM);
+    if(line_length * var->yres_virtual > SFB_FBMEMSIZE) return(-ENOMEM);
     
     sfb_fixup_var_modes(var);
     return(0);
@@ -425,14 +1883,242 @@ static int sfb_check_var(struct fb_var_screeninfo *var, struct fb_info *info)
 
 // -----------------------------------------------------------------------------
 // This routine actually sets the video mode. All validation has
-// been done already. In our case, this is a stub
+// been done already. The scanout wraps at the end of the virtual screen.
 // -----------------------------------------------------------------------------
 static int sfb_set_par(struct fb_info *info)
 {
+    u32 i;
+
     info->fix.line_length = get_line_length(info->var.xres_virtual,info->var.bits_per_pixel);
+    if(info->var.bits_per_pixel == 8) {
+        info->fix.visual = FB_VISUAL_PSEUDOCOLOR;
+        sfb_ctrl |=  LCD_CTRL_PAL8;
+    }
+    else {
+        info->fix.visual = FB_VISUAL_TRUECOLOR;
+        sfb_ctrl &= ~LCD_CTRL_PAL8;
+    }
+    if(info->var.xres == LCD_WIDTH / 2) sfb_ctrl |=  LCD_CTRL_SCALE2;   // Pixels shown 2x2
+    else                                sfb_ctrl &= ~LCD_CTRL_SCALE2;
+    if(sfb_text_mode(info)) {                           // Character cells, fbcon uses the tile ops
+        sfb_ctrl    |=  LCD_CTRL_TEXT;
+        info->flags |=  FBINFO_MISC_TILEBLITTING;
+        info->flags &= ~(FBINFO_HWACCEL_YPAN | FBINFO_HWACCEL_YWRAP);  // Cells do not pan,
+        info->fix.ypanstep  = 0;                        // so fbcon scrolls with tilecopy
+        info->fix.ywrapstep = 0;
+        fb_writew(TXT_ROW, SFB_REG(LCD_REG_SCAN));
+        for(i = 0; i < 16 && i < info->cmap.len; i++) {  // Console colors set in graphics mode
+            fb_writeb(i, SFB_REG(LCD_REG_CLUTA));
+            sfb_reg_writew(SFB_RGB565(info->cmap.red[i], info->cmap.green[i], info->cmap.blue[i]),
+                           SFB_REG(LCD_REG_CLUT));
+        }
+    }
+    else {
+        sfb_ctrl    &= ~LCD_CTRL_TEXT;
+        info->flags &= ~FBINFO_MISC_TILEBLITTING;
+        info->flags |=  FBINFO_HWACCEL_YPAN | FBINFO_HWACCEL_YWRAP;
+        info->fix.ypanstep  = 1;
+        info->fix.ywrapstep = 1;
+        fb_writew(info->var.yoffset, SFB_REG(LCD_REG_SCAN));
+    }
+    fb_writeb(sfb_ctrl, SFB_REG(LCD_REG_CTRL));
+    fb_writew(info->var.yres_virtual, SFB_REG(LCD_REG_WRAP));
+    sfb_set_timing(&info->var);
+    return(0);
+}
+
+// -----------------------------------------------------------------------------
+// debugfs sfb/perf: reading snapshots the FPGA performance counters and lists
+// them, writing "0" or "reset" clears them. The snapshot is taken at the start
+// of a read so a read in several pieces stays consistent.
+// -----------------------------------------------------------------------------
+static const char *sfb_perf_names[PRF_CNT_NUM] = {
+    "write_bytes", "read_bytes", "wait_clocks", "fifo_peak", "fetch_misses", "refreshes", "idle_clocks"
+};
+
+static ssize_t sfb_perf_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+    char text[(PRF_CNT_NUM + 1) * 32];
+    int i, len = 0;
+    u32 v;
+
+    mutex_lock(&sfb_perf_lock);
+    if(*ppos == 0) fb_writeb(PRF_CTRL_SNAP, PRF_REG(PRF_REG_CTRL));
+    for(i = 0; i < PRF_CNT_NUM; i++) {
+        fb_writeb(i, PRF_REG(PRF_REG_SEL));
+        v  = fb_readb(PRF_REG(PRF_REG_VAL));
+        v |= fb_readb(PRF_REG(PRF_REG_VAL + 1)) << 8;
+        v |= fb_readb(PRF_REG(PRF_REG_VAL + 2)) << 16;
+        v |= (u32)fb_readb(PRF_REG(PRF_REG_VAL + 3)) << 24;
+        len += snprintf(text + len, sizeof(text) - len, "%-14s %u\n", sfb_perf_names[i], v);
+    }
+    len += snprintf(text + len, sizeof(text) - len, "%-14s %lu\n", "vblank_misses", sfb_fetch_misses);
+    mutex_unlock(&sfb_perf_lock);
+    return(simple_read_from_buffer(buf, count, ppos, text, len));
+}
+
+static ssize_t sfb_perf_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+    char cmd[8];
+    size_t n = min(count, sizeof(cmd) - 1);
+
+    if(copy_from_user(cmd, buf, n)) return(-EFAULT);
+    cmd[n] = 0;
+    if(n && cmd[n - 1] == '\n') cmd[n - 1] = 0;
+    if(strcmp(cmd, "0") && strcmp(cmd, "reset")) return(-EINVAL);   // Only an explicit clear
+
+    mutex_lock(&sfb_perf_lock);
+    fb_writeb(PRF_CTRL_CLR, PRF_REG(PRF_REG_CTRL));
+    sfb_fetch_misses = 0;
+    mutex_unlock(&sfb_perf_lock);
+    return(count);
+}
+
+static const struct file_operations sfb_perf_fops = {
+    .owner = THIS_MODULE,
+    .read  = sfb_perf_read,
+    .write = sfb_perf_write,
+};
+
+// -----------------------------------------------------------------------------
+// Bus timing calibration. NCS2 starts out at the conservative SMC_BITDEF, then
+// each candidate setting writes a few patterns to the scratch line, lets the
+// write cache drain and reads them back. Candidates are tried cheapest first,
+// counting setup + wait states + hold, so the first one that survives every
+// pass is the fastest working one. It gets SMC_CAL_MARGIN more wait states,
+// which must pass too, so temperature and supply drift do not take it over
+// the edge. Wait state, setup and hold module parameters pin that field and
+// the sweep covers the rest.
+// -----------------------------------------------------------------------------
+static u8 sfb_cal_byte(int pass, int i)
+{
+    switch(pass & 3) {
+    case 0:  return(i ^ (i >> 8));                     // Address as data
+    case 1:  return((i & 1) ? 0xAA : 0x55);            // Every line toggling
+    case 2:  return((i & 8) ? ~(1 << (i & 7)) : (1 << (i & 7))); // Walking one and zero
+    default: return(i * 167 + 13);                     // No pattern at all
+    }
+}
+
+static int sfb_cal_test(void)
+{
+    u8 __iomem *p = sfb_io + SFB_CAL_OFFSET;
+    int pass, i;
+
+    for(pass = 0; pass < SMC_CAL_PASSES; pass++) {
+        for(i = 0; i < SFB_LINE; i++) fb_writeb(sfb_cal_byte(pass, i), p + i);
+        if(sfb_wait_idle()) return(-ETIMEDOUT);
+        for(i = 0; i < SFB_LINE; i++)
+            if(fb_readb(p + i) != sfb_cal_byte(pass, i)) return(-EIO);
+    }
     return(0);
 }
 
+// -----------------------------------------------------------------------------
+// A candidate that was too fast may have written its bytes anywhere, register
+// page included. Put back the state set_par does not write.
+// -----------------------------------------------------------------------------
+static void sfb_cal_reset(void)
+{
+    fb_writeb(0, OVL_REG(OVL_REG_CTRL));        // Overlay and cursor off
+    fb_writeb(0, CUR_REG(CUR_REG_CTRL));
+    sfb_blt_wait();                             // A stray CMD may have started the engine
+    sfb_reg_writew(0, BLT_REG(BLT_REG_WIDTH));
+    sfb_reg_writew(0, BLT_REG(BLT_REG_HGT));
+    sfb_reg_writew(0, RLE_REG(RLE_REG_ADDR));
+    sfb_stream_start(0, 0, 0);
+}
+
+static void sfb_calibrate(unsigned long *regptr)
+{
+    int nws = SMC_NWS, setup = 0, hold = 0;   // SMC_BITDEF
+    int nmax, smax, hmax, n, s, h, cost, margin = 0;
+    const char *how = "default";
+    u8 *save = NULL;
+
+    if(!smc_cal) {                            // Take the parameters as given
+        if(smc_nws >= 0)   nws = smc_nws, how = "module parameters";
+        if(smc_setup >= 0) setup = smc_setup, how = "module parameters";
+        if(smc_hold >= 0)  hold = smc_hold, how = "module parameters";
+        regptr[SMC_CSR2] = SMC_CSR_VALUE(nws, setup, hold);
+        goto report;
+    }
+
+    nmax = smc_nws >= 0 ? smc_nws : SMC_CAL_NWS;     // A pinned field may sit outside the sweep
+    smax = smc_setup >= 0 ? smc_setup : SMC_CAL_EDGE;
+    hmax = smc_hold >= 0 ? smc_hold : SMC_CAL_EDGE;
+
+    // Keep whatever is in the scratch line, read at the known good timing -----
+    save = kmalloc(SFB_LINE, GFP_KERNEL);
+    if(save) sfb_read_span(save, sfb_io, SFB_CAL_OFFSET, SFB_LINE);
+
+    for(cost = 0; cost <= nmax + smax + hmax; cost++) {
+        for(s = smax; s >= 0; s--) {              // Spend the budget on the edges first
+            for(h = hmax; h >= 0; h--) {
+                n = cost - s - h;
+                if(n < 0 || n > nmax) continue;
+                if((smc_nws >= 0 && n != smc_nws) || (smc_setup >= 0 && s != smc_setup) ||
+                   (smc_hold >= 0 && h != smc_hold)) continue;   // Pinned by a parameter
+                regptr[SMC_CSR2] = SMC_CSR_VALUE(n, s, h);
+                if(!sfb_cal_test()) {
+                    nws = n, setup = s, hold = h;
+                    how = "calibrated";
+                    goto found;
+                }
+            }
+        }
+    }
+    printk(KERN_WARNING "sfb: no SMC timing passed the pattern test, using the default\n");
+    goto restore;
+
+found:
+    if(smc_nws < 0) margin = min(SMC_CAL_MARGIN, 127 - nws);   // A pinned NWS gets no margin
+    regptr[SMC_CSR2] = SMC_CSR_VALUE(nws + margin, setup, hold);
+    if(sfb_cal_test()) {
+        printk(KERN_WARNING "sfb: SMC timing failed with margin, using the default\n");
+        nws = SMC_NWS, setup = 0, hold = 0, margin = 0;
+        how = "default";
+    }
+    else nws += margin;
+
+restore:
+    regptr[SMC_CSR2] = SMC_CSR_VALUE(nws, setup, hold);
+    sfb_cal_reset();
+    if(save) {
+        sfb_write_span(sfb_io, SFB_CAL_OFFSET, save, SFB_LINE);
+        sfb_wait_idle();
+        kfree(save);
+    }
+
+report:
+    printk(KERN_INFO "sfb: NCS2 %d wait states, setup %d, hold %d, margin %d (%s)\n",
+           nws, setup, hold, margin, how);
+}
+
+// -----------------------------------------------------------------------------
+// Seed the shadow from the FPGA. Only the visible part of the screen and the
+// text cells above the virtual screen are read back, the rest of the virtual
+// screen is cleared in both copies so they start out equal.
+// -----------------------------------------------------------------------------
+static void __init sfb_shadow_seed(struct fb_info *info)
+{
+    u8 *base = (u8 *)info->screen_base;
+    unsigned long vis = info->var.xres * (info->var.bits_per_pixel >> 3);
+    unsigned long p   = info->var.yres * SFB_LINE;
+    unsigned long end = info->var.yres_virtual * SFB_LINE;
+    u32 y;
+
+    memset(base, 0, end);
+    for(y = 0; y < info->var.yres; y++) {
+        sfb_read_span(base + y * SFB_LINE, sfb_io, y * SFB_LINE, vis);
+        if(vis < SFB_LINE)                      // Right margin of the row
+            sfb_write_span(sfb_io, y * SFB_LINE + vis, base + y * SFB_LINE + vis, SFB_LINE - vis);
+    }
+    if(end > p && (!blit || sfb_blt_paint(0, info->var.yres, SFB_LINE, info->var.yres_virtual - info->var.yres, 0)))
+        sfb_write_span(sfb_io, p, base + p, end - p);
+    sfb_read_span(base + end, sfb_io, end, SFB_FBMEMSIZE - end);
+}
+
 // -----------------------------------------------------------------------------
 // Driver Entry point 
 // -----------------------------------------------------------------------------
@@ -440,6 +2126,12 @@ int __init sfb_init(void)
 {
     unsigned long *regptr;
 
+    // -1 lets the calibration pick the field, anything else must fit it ------
+    if(smc_nws < -1 || smc_nws > 127 || smc_setup < -1 || smc_setup > 7 || smc_hold < -1 || smc_hold > 7) {
+        printk(KERN_ERR "sfb: smc_nws must be -1 or 0-127, smc_setup and smc_hold -1 or 0-7\n");
+        return(-EINVAL);
+    }
+
     // Initialize AT91 SMC REG--------------------------------------------------
     regptr = ioremap(EBI_BASE, 64);
     regptr[SMC_CSR2] = SMC_BITDEF;     // Register bit definitions Set up NCS2
@@ -450,21 +2142,73 @@ int __init sfb_init(void)
     }
 
     // Fill fb_info structure --------------------------------------------------
-    fb_info.screen_base = ioremap(videomemory, videomemorysize);
-    fb_info.screen_size = SFB_VIDEOMEMSIZE;
+    sfb_io              = ioremap(videomemory, videomemorysize);
+    fb_info.screen_base = sfb_io;
+    sfb_calibrate(regptr);             // Needs sfb_io, before anything else goes over the bus
+    fb_info.screen_size = SFB_FBMEMSIZE;
     fb_info.fbops       = &sfb_ops;
     fb_info.var         = sfb_var;
     fb_info.fix         = sfb_fix;
 //  fb_info.flags       = FBINFO_FLAG_DEFAULT;
-    fb_info.flags       = 0x0000;       // Default, no special flags
+    fb_info.flags       = FBINFO_HWACCEL_YPAN | FBINFO_HWACCEL_YWRAP;  // Scanout base register
 
     fb_info.pseudo_palette = pseudo_palette;
 
+    if(TRANSLATE_ADDRESS) blit = text = stream = 0;  // The 2D engine, text mode and streaming port work in DRAM rows
+    if(blit) fb_info.flags |= FBINFO_HWACCEL_FILLRECT | FBINFO_HWACCEL_COPYAREA | FBINFO_HWACCEL_IMAGEBLIT;
+
+    if(text) {                         // Start the console in text mode
+        fb_info.tileops        = &sfb_tileops;
+        fb_info.var.accel_flags |= FB_ACCELF_TEXT;
+        fb_info.pixmap.blit_x  = 1 << (TXT_FONT_W - 1);  // Only fonts the font RAM can hold
+        fb_info.pixmap.blit_y  = 1 << (TXT_FONT_H - 1);
+    }
+
     fb_alloc_cmap(&fb_info.cmap, 256, 0);
+    INIT_LIST_HEAD(&fb_info.modelist);      // Modes listed in sysfs
+    fb_videomode_to_modelist(sfb_modes, ARRAY_SIZE(sfb_modes), &fb_info.modelist);
+    sfb_set_par(&fb_info);
+
+    // Set up the shadow, starting from what is on the screen now ---------------
+    if(shadow) {
+        fb_info.screen_base = vmalloc(SFB_FBMEMSIZE);
+        if(!fb_info.screen_base) {
+            printk(KERN_WARNING "sfb: no memory for shadow, drawing directly\n");
+            fb_info.screen_base = sfb_io;
+            shadow = 0;
+        }
+        else {
+            sfb_shadow_seed(&fb_info);
+            fb_info.flags  |= FBINFO_VIRTFB;
+            fb_info.fbdefio = &sfb_defio;
+            fb_deferred_io_init(&fb_info);
+        }
+    }
+
+    // Start the async write worker, the shadow already defers writes --------
+    if(async && !shadow) {
+        sfb_wq = create_singlethread_workqueue("sfb");
+        if(!sfb_wq) printk(KERN_WARNING "sfb: no async worker, writing directly\n");
+    }
+
+    // Hook up the vertical blank interrupt ------------------------------------
+    at91_set_gpio_input(LCD_IRQ_PIN, 0);
+    if(request_irq(gpio_to_irq(LCD_IRQ_PIN), sfb_vbl_irq, 0, "sfb vblank", &fb_info)) {
+        printk(KERN_WARNING "sfb: no vertical blank interrupt\n");
+    }
+    else {
+        sfb_irq = gpio_to_irq(LCD_IRQ_PIN);
+        sfb_ctrl |= LCD_CTRL_VBLI;
+        fb_writeb(sfb_ctrl, SFB_REG(LCD_REG_CTRL));
+    }
 
     // Register the driver -----------------------------------------------------
     if(register_framebuffer(&fb_info) < 0) return(-EINVAL);
 
+    sfb_debugfs = debugfs_create_dir("sfb", NULL);      // Optional, counters only
+    if(IS_ERR(sfb_debugfs)) sfb_debugfs = NULL;
+    if(sfb_debugfs) debugfs_create_file("perf", 0600, sfb_debugfs, NULL, &sfb_perf_fops);
+
 //  printk(KERN_INFO "sfb: getlen=%p\n", get_line_length(fb_info.var.xres_virtual, fb_info.var.bits_per_pixel));
 
     printk(KERN_INFO "fb%d: Simple frame buffer device initialized \n", fb_info.node);
@@ -474,7 +2218,25 @@ int __init sfb_init(void)
 // -----------------------------------------------------------------------------
 static void __exit sfb_cleanup(void)
 {
+    debugfs_remove_recursive(sfb_debugfs);
     unregister_framebuffer(&fb_info);
+    fb_destroy_modelist(&fb_info.modelist);
+    sfb_blt_wait();
+    fb_writeb(0, OVL_REG(OVL_REG_CTRL));       // Overlay off
+    if(sfb_irq >= 0) {
+        sfb_ctrl &= ~LCD_CTRL_VBLI;
+        fb_writeb(sfb_ctrl, SFB_REG(LCD_REG_CTRL));
+        free_irq(sfb_irq, &fb_info);
+    }
+    if(sfb_wq) {
+        flush_workqueue(sfb_wq);
+        destroy_workqueue(sfb_wq);
+    }
+    if(shadow) {
+        fb_deferred_io_cleanup(&fb_info);
+        vfree(fb_info.screen_base);
+    }
+    iounmap(sfb_io);
 }
 
 // -----------------------------------------------------------------------------
@@ -10,9 +10,136 @@
 #define     TOPMEM        0x30200000     // Top of Address space of vid
 #define     MEMEND        0x301FFFFF     // LCD RAM End 
 
-//#define     LCD_WIDTH     640            // LCD visible display width
-#define     LCD_WIDTH     1024            // LCD visible display width
+#define     LCD_FBSIZE    0x001F0000     // Frame buffer part of the vid address space
+#define     LCD_ROWS      1024           // FPGA DRAM rows
+
+#define     LCD_WIDTH     640            // LCD visible display width
 #define     LCD_HEIGHT    480            // LCD visible display height
+#define     LCD_LINE      1280           // Bytes per display line (640 * 2)
+#define     LCD_PITCH     2048           // Bytes per FPGA DRAM row
+
+//---------------------------------------------------------------------------
+// LCD control registers in the FPGA, offsets in the vid address space
+//---------------------------------------------------------------------------
+#define     LCD_REG_BASE  0x001FDFF0     // Scanout control bank
+#define     LCD_REG_SCAN  0x00000000     // Scanout base row, 16 bits, taken at vblank
+#define     LCD_REG_STAT  0x00000002     // Status register
+#define     LCD_REG_CTRL  0x00000003     // Control register
+#define     LCD_REG_WRAP  0x00000004     // Scanout wrap rows, 16 bits, 0 = no wrap
+#define     LCD_REG_CLUTA 0x00000006     // CLUT entry index
+#define     LCD_REG_CLUT  0x00000007     // CLUT entry, RGB565, 16 bits, increments the index
+
+#define     LCD_STAT_VBL  0x01           // In vertical blank
+#define     LCD_STAT_FLIP 0x02           // Scanout base change pending
+#define     LCD_STAT_IDLE 0x04           // Write cache FIFO is empty
+#define     LCD_STAT_MISS 0x08           // A line fetch missed its deadline, writing STAT clears it
+#define     LCD_CTRL_VBLI 0x01           // Vertical blank interrupt enable
+#define     LCD_CTRL_PAL8 0x02           // 8 bit pseudocolor through the CLUT
+#define     LCD_CTRL_TEXT 0x04           // Text mode, character cells from the scanout base row
+#define     LCD_CTRL_SCALE2 0x08         // 2x pixel and line replication, LCD_WIDTH/2 x LCD_HEIGHT/2
+
+#define     LCD_IRQ_PIN   AT91_PIN_PB12  // GPIO wired to the FPGA lcd_irq output
+
+#define     CUR_REG_BASE  0x001FDFE0     // Hardware cursor bank
+#define     CUR_REG_X     0x00000000     // Position X, 16 bits
+#define     CUR_REG_Y     0x00000002     // Position Y, 16 bits
+#define     CUR_REG_HOTX  0x00000004     // Hotspot X
+#define     CUR_REG_HOTY  0x00000005     // Hotspot Y
+#define     CUR_REG_CTRL  0x00000006     // Control register
+#define     CUR_REG_ADDR  0x00000007     // Image byte address
+#define     CUR_REG_DATA  0x00000008     // Image data, auto increments the address
+#define     CUR_REG_COL1  0x00000009     // Color 1, RGB565, 16 bits
+#define     CUR_REG_COL2  0x0000000B     // Color 2, RGB565, 16 bits
+
+#define     CUR_CTRL_EN   0x01           // Cursor enable
+#define     CUR_SIZE      32             // Cursor sprite is 32x32, 2 bits per pixel
+#define     CUR_BG        0x01           // Pixel codes: color 1
+#define     CUR_FG        0x02           //              color 2
+
+#define     BLT_REG_BASE  0x001FDFD0     // 2D engine bank
+#define     BLT_REG_DCOL  0x00000000     // Destination DRAM column in bytes, 16 bits
+#define     BLT_REG_DROW  0x00000002     // Destination DRAM row, 16 bits
+#define     BLT_REG_SCOL  0x00000004     // Source DRAM column in bytes, 16 bits
+#define     BLT_REG_SROW  0x00000006     // Source DRAM row, 16 bits
+#define     BLT_REG_WIDTH 0x00000008     // Width in bytes, 16 bits
+#define     BLT_REG_HGT   0x0000000A     // Height in rows, 16 bits
+#define     BLT_REG_COLOR 0x0000000C     // Fill color, RGB565, 16 bits
+#define     BLT_REG_CMD   0x0000000E     // Command, writing it starts the engine
+#define     BLT_REG_STAT  0x0000000F     // Status register
+
+#define     BLT_CMD_FILL  0x01           // Fill the destination with the color
+#define     BLT_CMD_COPY  0x02           // Copy the source to the destination
+#define     BLT_CMD_REV   0x04           // Bottom up, right to left, rows name the last row
+#define     BLT_CMD_EXPAND 0x08          // Expand the bitmap, COLOR for 1 bits, EXP BG for 0
+#define     BLT_CMD_RLE   0x10           // Decode the RLE stream into the destination
+#define     BLT_STAT_BUSY 0x01           // Command in progress
+
+#define     EXP_REG_BASE  0x001FDFC0     // Color expansion bank
+#define     EXP_REG_BG    0x00000000     // Background color, RGB565, 16 bits
+#define     EXP_REG_ADDR  0x00000002     // Bitmap byte address, 16 bits
+#define     EXP_REG_DATA  0x00000004     // Bitmap data, auto increments the address
+#define     EXP_BUF_SIZE  512            // Bitmap buffer bytes
+
+#define     STR_REG_BASE  0x001FDF80     // Streaming port bank
+#define     STR_REG_PTR   0x00000000     // Stream DRAM address, 24 bits, the top byte restarts it
+#define     STR_REG_LEFT  0x00000004     // Column to go back to on the next row, 16 bits
+#define     STR_REG_RIGHT 0x00000006     // Column to wrap at, 16 bits, 0 = no wrap
+#define     STR_WIN_BASE  0x001F0000     // Stream data window, any address takes the next byte
+#define     STR_WIN_SIZE  0x00001000     // Stream data window size
+
+#define     RLE_REG_BASE  0x001FDF90     // RLE stream bank
+#define     RLE_REG_ADDR  0x00000000     // Stream byte address, 16 bits
+#define     RLE_REG_DATA  0x00000002     // Stream data, auto increments the address
+#define     RLE_BUF_SIZE  2048           // Stream buffer bytes
+
+#define     TXT_REG_BASE  0x001FDFB0     // Text mode font bank
+#define     TXT_REG_ADDR  0x00000000     // Font byte address, char * 16 + line, 16 bits
+#define     TXT_REG_DATA  0x00000002     // Font data, auto increments the address
+
+#define     OVL_REG_BASE  0x001FDFA0     // YUV overlay bank
+#define     OVL_REG_X     0x00000000     // Window X, 16 bits
+#define     OVL_REG_Y     0x00000002     // Window Y, 16 bits
+#define     OVL_REG_W     0x00000004     // Window width, even, 16 bits
+#define     OVL_REG_H     0x00000006     // Window height, 16 bits
+#define     OVL_REG_ROW   0x00000008     // Source row of the Y or YUYV lines, 16 bits, taken at vblank
+#define     OVL_REG_CROW  0x0000000A     // Source row of the planar U/V lines, 16 bits, taken at vblank
+#define     OVL_REG_CTRL  0x0000000C     // Control register
+
+#define     OVL_CTRL_EN   0x01           // Overlay enable
+#define     OVL_CTRL_420  0x02           // Planar 4:2:0, else packed 4:2:2
+#define     OVL_VCOL      1024           // Planar V bytes start at this column of the chroma row
+
+#define     PRF_REG_BASE  0x001FDF60     // Performance counter bank
+#define     PRF_REG_CTRL  0x00000000     // Control register
+#define     PRF_REG_SEL   0x00000001     // Snapshot counter to read
+#define     PRF_REG_VAL   0x00000004     // Selected snapshot, 32 bits, low byte first
+
+#define     PRF_CTRL_SNAP 0x01           // Copy all counters into the snapshot
+#define     PRF_CTRL_CLR  0x02           // Clear all counters
+#define     PRF_CNT_WRITE 0              // CPU bytes written through the FIFO
+#define     PRF_CNT_READ  1              // CPU bytes read
+#define     PRF_CNT_WAIT  2              // 100MHz clocks with cpu_wait raised
+#define     PRF_CNT_PEAK  3              // Highest write FIFO occupancy, entries
+#define     PRF_CNT_MISS  4              // Line fetches that missed their deadline
+#define     PRF_CNT_REFR  5              // DRAM refresh cycles
+#define     PRF_CNT_IDLE  6              // 100MHz clocks the DRAM had no work
+#define     PRF_CNT_NUM   7
+
+#define     TIM_REG_BASE  0x001FDF70     // Display timing bank
+#define     TIM_REG_HACT  0x00000000     // Active pixels per line, 16 bits
+#define     TIM_REG_HTOT  0x00000002     // Total pixels per line, 16 bits
+#define     TIM_REG_VACT  0x00000004     // Active lines per frame, 16 bits
+#define     TIM_REG_VTOT  0x00000006     // Total lines per frame, 16 bits
+#define     TIM_REG_DIV   0x00000008     // Pixel clock divider, log2, commits, taken at the end of the frame
+#define     TIM_PIXCLOCK  40000          // Undivided pixel clock period in ps, 25MHz
+#define     TIM_DIV_MAX   2              // Slowest pixel clock, 6.25MHz
+#define     TIM_FETCH_PS  20000          // DRAM time per fetched byte, 2 clocks at 100MHz
+#define     TIM_FETCH_PCT 75             // Most of a line the scanout fetch may take
+
+#define     TXT_FONT_W    8              // Character cell width
+#define     TXT_FONT_H    16             // Character cell height
+#define     TXT_COLS      (LCD_WIDTH / TXT_FONT_W)    // Cells across
+#define     TXT_ROWS      (LCD_HEIGHT / TXT_FONT_H)   // Cells down
 
 //---------------------------------------------------------------------------
 // AT91 IO Control register  definitions
@@ -50,6 +177,18 @@
 
 #define SMC_BITDEF  SMC_RWHOLD|SMC_RWSETUP|SMC_ACSS|SMC_DRP|SMC_DBW|SMC_BAT|SMC_TDF|SMC_WSEN|SMC_NWS
 
+// Fields the load time calibration sweeps, the rest stay as in SMC_BITDEF
+#define SMC_NWS_MASK      0x0000007F     // 00:06
+#define SMC_RWSETUP_SHIFT 24             // 24:26
+#define SMC_RWHOLD_SHIFT  28             // 28:30
+#define SMC_CYCLE_MASK    (SMC_NWS_MASK | (7 << SMC_RWSETUP_SHIFT) | (7 << SMC_RWHOLD_SHIFT))
+#define SMC_CSR_VALUE(nws, setup, hold) \
+    (((SMC_BITDEF) & ~SMC_CYCLE_MASK) | (nws) | ((setup) << SMC_RWSETUP_SHIFT) | ((hold) << SMC_RWHOLD_SHIFT))
+#define SMC_CAL_NWS       7              // Slowest setting swept, same as SMC_NWS
+#define SMC_CAL_EDGE      2              // Most setup or hold cycles swept
+#define SMC_CAL_PASSES    4              // Clean pattern runs a setting must survive
+#define SMC_CAL_MARGIN    1              // Wait states added to the fastest passing setting
+
 //---------------------------------------------------------------------------
 // GPIO Registers (for LCD Enable
 //---------------------------------------------------------------------------
@@ -71,13 +210,91 @@
 #define     PIO_PUDR                  0x00000060 /4
 #define     PIO_OWDR                  0x000000A4 /4
 
+// -----------------------------------------------------------------------------
+// FPGA DRAM layout, must match the LinearPitch parameter in lcd1.v
+//   TRANSLATE_ADDRESS 0: linear frame buffer with the 2048 byte DRAM pitch,
+//                        so mmap() gives a correct view of the screen
+//   TRANSLATE_ADDRESS 1: 1280 byte logical lines, each remapped by the
+//                        driver and the FPGA onto its own 2048 byte DRAM row
+// -----------------------------------------------------------------------------
+#define TRANSLATE_ADDRESS 0
+#if TRANSLATE_ADDRESS
+#define SFB_LINE          LCD_LINE       // Logical line length
+#define SFB_ROWS          512            // Translation only covers the low 1MB
+#else
+#define SFB_LINE          LCD_PITCH      // Logical line is the DRAM row
+#define SFB_ROWS          (LCD_FBSIZE/LCD_PITCH)
+#endif
+
 // -----------------------------------------------------------------------------
 #define SFB_VIDEOMEMSTART (unsigned long) LCD_BASE
 #define SFB_VIDEOMEMSIZE  (unsigned long) LCD_SPACE
+#define SFB_FBMEMSIZE     (unsigned long) (SFB_LINE*SFB_ROWS)
+#define SFB_VIRT_X        (SFB_LINE/2)   // Pixels per line including padding
+#if SFB_ROWS >= 2*LCD_HEIGHT
+#define SFB_VIRT_Y        (2*LCD_HEIGHT) // Room for a back buffer to flip to
+#else
+#define SFB_VIRT_Y        LCD_HEIGHT
+#endif
 #define SFB_MAX_X         LCD_WIDTH
 #define SFB_MAX_Y         LCD_HEIGHT
 #define SFB_MIN_X         LCD_WIDTH
 #define SFB_MIN_Y         LCD_HEIGHT
+#define TXT_ROW           SFB_VIRT_Y     // Text cells live in the DRAM rows above the screen
+#define SFB_CAL_OFFSET    (SFB_FBMEMSIZE - SFB_LINE) // Last line, above the text cells, scratch for SMC calibration
+
+// -----------------------------------------------------------------------------
+// SFB specific ioctls
+// -----------------------------------------------------------------------------
+#define SFB_MAX_RECTS     256            // Rectangles per SFBIO_UPLOAD call
+
+struct sfb_rect {                        // One damaged rectangle
+    __u16 x, y;                          // Destination in pixels
+    __u16 w, h;                          // Size in pixels
+    __u32 stride;                        // Source bytes per line
+    const void *src;                     // Source pixels, user pointer
+};
+
+struct sfb_upload {                      // Argument for SFBIO_UPLOAD
+    __u32 count;                         // Number of rectangles
+    const struct sfb_rect *rects;        // Rectangle list, user pointer
+};
+
+#define SFBIO_UPLOAD      _IOW('F', 0x80, struct sfb_upload)   // Upload rectangles
+
+#define SFBIO_FENCE       _IOR('F', 0x81, __u32)               // Fence for all writes so far
+#define SFBIO_WAIT        _IOW('F', 0x82, __u32)               // Wait for a fence to drain
+
+#define SFB_OVL_YUYV      0              // Packed 4:2:2, Y0 U Y1 V, a DRAM row per line
+#define SFB_OVL_YUV420    1              // Planar 4:2:0, a Y row per line, a U/V row per 2 lines
+
+struct sfb_overlay {                     // Argument for SFBIO_OVERLAY
+    __u32 enable;                        // 0 turns the overlay off
+    __u32 format;                        // SFB_OVL_ source format
+    __u16 x, y;                          // Window on the screen in pixels
+    __u16 w, h;                          // Window size, w even
+    __u16 row;                           // Frame buffer row of the first Y (or YUYV) line
+    __u16 crow;                          // Row of the first U/V line, planar only,
+};                                       // U from column 0, V from column OVL_VCOL
+
+#define SFBIO_OVERLAY     _IOW('F', 0x83, struct sfb_overlay)  // Set up or flip the overlay
+
+#define SFB_RLE_RUN       0x8000         // Packet header: run of one color, else literal
+#define SFB_RLE_COUNT     0x7FFF         // Packet header: pixels in the packet less one
+
+struct sfb_rle {                         // Argument for SFBIO_RLE
+    __u16 x, y;                          // Destination in pixels
+    __u16 w, h;                          // Size in pixels
+    __u32 size;                          // Stream bytes
+    const __u16 *data;                   // Packets in raster order, user pointer. A run is
+};                                       // header + color, a literal header + pixels padded
+                                         // to a word. A packet never crosses a row.
+
+#define SFBIO_RLE         _IOW('F', 0x84, struct sfb_rle)      // Draw an RLE encoded rectangle
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, __u32)               // Wait for vertical blank
+#endif
 
 // No transparency support in our hardware -------------------------------------
 #define TRANSP_OFFSET     0